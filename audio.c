@@ -0,0 +1,720 @@
+#include "audio.h"
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+static UnderrunEvent underrunLog[MAX_UNDERRUN_EVENTS];
+static int underrunTotal = 0;
+
+static double streamUpdateTotal[2] = { 0 };     // [crossfading]
+static double streamUpdateMax[2] = { 0 };
+static int streamUpdateCount[2] = { 0 };
+
+static int seekCount = 0;
+static float seekLatencyTotal = 0.0f;
+static float seekLatencyMax = 0.0f;
+static int playCount[2] = { 0 };                // [prefetched]
+static float playLatencyTotal[2] = { 0 };
+static float playLatencyMax[2] = { 0 };
+static int decoderLookups = 0;
+static int decoderHits = 0;
+static int decoderEvictions = 0;
+static int openStreamFilesMax = 0;
+static int readAheadHints = 0;
+static size_t preloadFootprint = 0;
+static int preloadFiles = -1;
+static int preloadSkipped = 0;
+static float firstAudioSeconds = -1.0f;
+static bool firstAudioResumed = false;
+
+// Time of the last underrun seen at each adaptive size, 0 = never
+static double adaptiveUnderrunTime[ADAPTIVE_BUFFER_SIZES] = { 0 };
+
+typedef struct StreamMonitor {
+    int id;                                 // 0 = free slot
+    AudioStream stream;
+    StemCurve curve;
+    float gain;                             // audio thread only, ramped towards the curve's gain
+    unsigned int frameCount;                // track length in stream frames
+    unsigned int startFrame;                // stream frame playback started from
+    _Atomic unsigned long long framesPlayed;// device frames handed to the mixer
+    _Atomic bool ended;
+    bool started;                           // audio thread only
+    _Atomic int fadeDirection;              // 1 = fading in, -1 = fading out, 0 = steady
+    _Atomic unsigned int fadeFrames;        // device frames a whole fade takes, 0 = cut
+    _Atomic unsigned long long fadeClock;   // device clock a fade out starts on
+    float fadePhase;                        // audio thread only, 0 = silent, 1 = full
+    _Atomic long long anchorClock;          // device clock stream frame 0 is (or would be) heard on
+    unsigned long long startClock;          // hold the stream back until this clock, 0 = start at once
+    unsigned int delayFrames;               // audio thread only
+    unsigned int delayPosition;
+    float delayLine[MAX_START_DELAY_FRAMES*DEVICE_CHANNELS];
+    unsigned long long callbackClock;       // audio thread only
+    unsigned int callbackOffset;            // frames already processed in this callback
+    float mixBlock[MAX_MIX_BLOCK_FRAMES*DEVICE_CHANNELS];   // audio thread only, this callback's output
+    unsigned int mixFrames;                 // frames of mixBlock filled in this callback
+} StreamMonitor;
+
+static StreamMonitor monitors[MAX_STREAM_MONITORS] = { 0 };
+static int nextMonitorId = 1;
+
+// Monitored streams hand their processed blocks over instead of leaving them to
+// raylib, and the mixed processor sums them in one kernel call. Audio thread only
+static StreamMonitor *mixInputs[MAX_STREAM_MONITORS];
+static int mixInputCount = 0;
+static unsigned long long mixClock = ~0ULL;
+
+// Advanced by the mixed processor at the end of every device callback
+static _Atomic unsigned long long deviceClock = 0;
+static _Atomic unsigned int deviceSampleRate = ASSUMED_DEVICE_SAMPLE_RATE;
+static bool deviceRateMeasured = false;
+static double clockStartTime = 0.0;
+static unsigned long long clockStartFrames = 0;
+
+// Single-producer ring: the mixed processor writes, one analysis thread reads
+static float outputTap[OUTPUT_TAP_FRAMES];
+static _Atomic bool outputTapEnabled = false;
+static _Atomic unsigned long long outputTapWritten = 0;
+
+// Frames the soft clipper stays engaged after the mix last passed full scale,
+// so quiet stretches inside a loud passage are not switched in and out of the curve
+static unsigned int softClipHoldFrames = 0;        // audio thread only
+
+// Written by the main thread on combat toggles and by the audio thread when the
+// shared channel changes; the latest write wins
+static _Atomic float combatIntensity = 0.0f;
+
+// Intensity to switch to on a device clock, 0 = nothing scheduled. Streams apply
+// it from that frame on, and the mixed processor commits it once the clock passed
+static _Atomic float scheduledIntensity = 0.0f;
+static _Atomic unsigned long long scheduledIntensityClock = 0;
+static IntensityChannel *_Atomic intensityChannel = NULL;
+static _Atomic int intensityChannelReaders = 0;    // audio thread inside PollIntensityChannel
+static uint32_t channelSequence = 0;                // audio thread only
+static unsigned long long intensityPollClock = ~0ULL;
+
+// Single producer (audio thread), single consumer (main loop)
+static AudioEvent audioEvents[MAX_AUDIO_EVENTS];
+static _Atomic unsigned int audioEventHead = 0;
+static _Atomic unsigned int audioEventTail = 0;
+
+static void PushAudioEvent(AudioEvent event) {
+    unsigned int head = atomic_load_explicit(&audioEventHead, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&audioEventTail, memory_order_acquire);
+    if (head - tail >= MAX_AUDIO_EVENTS) return;  // Main loop is not draining, drop
+
+    audioEvents[head % MAX_AUDIO_EVENTS] = event;
+    atomic_store_explicit(&audioEventHead, head + 1, memory_order_release);
+}
+
+bool PollAudioEvent(AudioEvent *event) {
+    unsigned int tail = atomic_load_explicit(&audioEventTail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&audioEventHead, memory_order_acquire);
+    if (tail == head) return false;
+
+    *event = audioEvents[tail % MAX_AUDIO_EVENTS];
+    atomic_store_explicit(&audioEventTail, tail + 1, memory_order_release);
+    return true;
+}
+
+static void MixMonitoredStreams(float *mixed, unsigned int frames) {
+    unsigned long long clock = atomic_load_explicit(&deviceClock, memory_order_relaxed);
+    if (mixClock != clock || mixInputCount == 0) return;
+
+    // Whatever raylib mixed itself (streams without a monitor, or the part of a long
+    // callback past the block) goes first, then the stems in the order they ran
+    unsigned int count = (frames < MAX_MIX_BLOCK_FRAMES) ? frames : MAX_MIX_BLOCK_FRAMES;
+    const float *inputs[MAX_STREAM_MONITORS + 1] = { mixed };
+    float gains[MAX_STREAM_MONITORS + 1] = { 1.0f };
+    for (int i = 0; i < mixInputCount; i++) {
+        StreamMonitor *monitor = mixInputs[i];
+        if (monitor->mixFrames < count) {
+            memset(monitor->mixBlock + monitor->mixFrames*DEVICE_CHANNELS, 0,
+                   (count - monitor->mixFrames)*DEVICE_CHANNELS*sizeof(float));
+        }
+        inputs[i + 1] = monitor->mixBlock;
+        gains[i + 1] = 1.0f;
+    }
+    dsp.MixInputs(mixed, inputs, gains, mixInputCount + 1, (int)(count*DEVICE_CHANNELS));
+    mixInputCount = 0;
+}
+
+static void AudioClockProcessor(void *buffer, unsigned int frames) {
+    float *mixed = (float *)buffer;
+    MixMonitoredStreams(mixed, frames);
+
+    // Stems can sum past full scale, bend the peaks instead of letting them wrap.
+    // Mixes that stay below it pass through untouched
+    float peak = 0.0f;
+    for (unsigned int i = 0; i < frames*DEVICE_CHANNELS; i++) peak = fmaxf(peak, fabsf(mixed[i]));
+    if (peak > 1.0f) softClipHoldFrames = atomic_load_explicit(&deviceSampleRate, memory_order_relaxed)/2;
+    if (softClipHoldFrames > 0) {
+        dsp.SoftClip(mixed, (int)(frames*DEVICE_CHANNELS));
+        softClipHoldFrames = (softClipHoldFrames > frames) ? softClipHoldFrames - frames : 0;
+    }
+
+    if (atomic_load_explicit(&outputTapEnabled, memory_order_relaxed)) {
+        const float *samples = (const float *)buffer;
+        unsigned long long written = atomic_load_explicit(&outputTapWritten, memory_order_relaxed);
+        for (unsigned int i = 0; i < frames; i++) {
+            outputTap[(written + i) & (OUTPUT_TAP_FRAMES - 1)] = 0.5f*(samples[2*i] + samples[2*i + 1]);
+        }
+        atomic_store_explicit(&outputTapWritten, written + frames, memory_order_release);
+    }
+
+    unsigned long long clock = atomic_load_explicit(&deviceClock, memory_order_relaxed) + frames;
+    unsigned long long scheduledClock = atomic_load_explicit(&scheduledIntensityClock, memory_order_acquire);
+    if (scheduledClock != 0 && scheduledClock <= clock) {
+        SetCombatIntensity(atomic_load_explicit(&scheduledIntensity, memory_order_relaxed));
+        atomic_compare_exchange_strong(&scheduledIntensityClock, &scheduledClock, 0);
+    }
+    atomic_fetch_add_explicit(&deviceClock, frames, memory_order_release);
+}
+
+void InitAudioClock(void) {
+    AttachAudioMixedProcessor(AudioClockProcessor);
+}
+
+void CloseAudioClock(void) {
+    DetachAudioMixedProcessor(AudioClockProcessor);
+}
+
+void UpdateAudioClock(void) {
+    if (deviceRateMeasured) return;
+
+    unsigned long long frames = atomic_load(&deviceClock);
+    if (frames == 0) return;
+    if (clockStartTime == 0.0) {
+        clockStartTime = GetTime();
+        clockStartFrames = frames;
+        return;
+    }
+
+    double elapsed = GetTime() - clockStartTime;
+    if (elapsed < 1.0) return;
+
+    // Callbacks arrive in bursts, so snap to the closest standard rate
+    static const unsigned int rates[] = { 22050, 32000, 44100, 48000, 88200, 96000, 176400, 192000 };
+    double measured = (frames - clockStartFrames)/elapsed;
+    unsigned int best = rates[0];
+    for (int i = 1; i < (int)(sizeof(rates)/sizeof(rates[0])); i++) {
+        if (fabs(measured - rates[i]) < fabs(measured - best)) best = rates[i];
+    }
+    atomic_store(&deviceSampleRate, best);
+    deviceRateMeasured = true;
+    printf("Audio device running at %u Hz\n", best);
+}
+
+unsigned long long GetAudioClock(void) {
+    return atomic_load_explicit(&deviceClock, memory_order_acquire);
+}
+
+unsigned int GetDeviceSampleRate(void) {
+    return atomic_load_explicit(&deviceSampleRate, memory_order_relaxed);
+}
+
+void SetOutputTapEnabled(bool enabled) {
+    atomic_store(&outputTapEnabled, enabled);
+}
+
+bool ReadOutputTap(float *dst, int frames) {
+    if (frames <= 0 || frames > OUTPUT_TAP_FRAMES/2) return false;
+    unsigned long long written = atomic_load_explicit(&outputTapWritten, memory_order_acquire);
+    if (written < (unsigned long long)frames) return false;
+
+    unsigned long long first = written - frames;
+    for (int i = 0; i < frames; i++) dst[i] = outputTap[(first + i) & (OUTPUT_TAP_FRAMES - 1)];
+
+    // Seqlock style: the copy is only good if the writer did not come round to it
+    atomic_thread_fence(memory_order_acquire);
+    unsigned long long after = atomic_load_explicit(&outputTapWritten, memory_order_relaxed);
+    return after - first <= OUTPUT_TAP_FRAMES;
+}
+
+void SetCombatIntensity(float intensity) {
+    atomic_store_explicit(&combatIntensity, intensity < 0.0f ? 0.0f : (intensity > 1.0f ? 1.0f : intensity), memory_order_relaxed);
+}
+
+void ScheduleCombatIntensity(float intensity, unsigned long long clock) {
+    // Published by the clock store
+    atomic_store_explicit(&scheduledIntensity, intensity < 0.0f ? 0.0f : (intensity > 1.0f ? 1.0f : intensity), memory_order_relaxed);
+    atomic_store_explicit(&scheduledIntensityClock, clock, memory_order_release);
+}
+
+float GetCombatIntensity(void) {
+    return atomic_load_explicit(&combatIntensity, memory_order_relaxed);
+}
+
+void SetIntensityChannel(IntensityChannel *channel) {
+    // The audio thread may hold the old pointer; once it is out, the caller can unmap it
+    atomic_store(&intensityChannel, channel);
+    // A read is a handful of loads, so give the audio thread the core and check again
+    while (atomic_load(&intensityChannelReaders) != 0) sched_yield();
+}
+
+bool ReadIntensityChannel(IntensityChannel *channel, IntensitySnapshot *snapshot) {
+    // Seqlock read: give up on this poll if the writer is mid-update
+    uint32_t before = atomic_load_explicit(&channel->sequence, memory_order_acquire);
+    if (before & 1) return false;
+
+    snapshot->intensity = atomic_load_explicit(&channel->intensity, memory_order_relaxed);
+    snapshot->level = atomic_load_explicit(&channel->level, memory_order_relaxed);
+    snapshot->segment = atomic_load_explicit(&channel->segment, memory_order_relaxed);
+    snapshot->request = atomic_load_explicit(&channel->request, memory_order_relaxed);
+
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&channel->sequence, memory_order_relaxed) != before) return false;
+    snapshot->sequence = before;
+    return true;
+}
+
+static void PollIntensityChannel(unsigned long long clock) {
+    // Once per device callback, whichever monitored stream runs first
+    if (clock == intensityPollClock) return;
+    intensityPollClock = clock;
+
+    // Announced before the pointer is loaded, so SetIntensityChannel waits for this read
+    atomic_fetch_add(&intensityChannelReaders, 1);
+    IntensityChannel *channel = atomic_load(&intensityChannel);
+    IntensitySnapshot snapshot;
+    bool changed = channel != NULL && ReadIntensityChannel(channel, &snapshot) && snapshot.sequence != channelSequence;
+    atomic_fetch_sub(&intensityChannelReaders, 1);
+    if (!changed) return;
+
+    channelSequence = snapshot.sequence;
+    SetCombatIntensity(snapshot.intensity);
+}
+
+float GetStemCurveGain(StemCurve curve, float intensity) {
+    float weight = 1.0f;
+    if (intensity < curve.peak && curve.low < curve.peak) {
+        weight = (intensity - curve.low)/(curve.peak - curve.low);
+    } else if (intensity > curve.peak && curve.high > curve.peak) {
+        weight = (curve.high - intensity)/(curve.high - curve.peak);
+    }
+    return curve.gain*(weight < 0.0f ? 0.0f : weight);
+}
+
+static void ApplyGainRamp(float *samples, unsigned int frames, float from, float to) {
+    if (frames == 0 || (from == 1.0f && to == 1.0f)) return;
+    dsp.GainRamp(samples, (int)frames, DEVICE_CHANNELS, from, to);
+}
+
+static void ProcessMonitoredStream(StreamMonitor *monitor, float *samples, unsigned int frames) {
+    // A stream can be processed in several chunks per device callback
+    unsigned long long clock = atomic_load_explicit(&deviceClock, memory_order_acquire);
+    if (clock != monitor->callbackClock) {
+        monitor->callbackClock = clock;
+        monitor->callbackOffset = 0;
+    }
+    PollIntensityChannel(clock);
+
+    // A stream scheduled to start on a clock is held back by a fixed delay, set
+    // from where its first block lands
+    if (!monitor->started) {
+        unsigned long long blockClock = clock + monitor->callbackOffset;
+        unsigned long long delay = (monitor->startClock > blockClock) ? monitor->startClock - blockClock : 0;
+        monitor->delayFrames = (delay < MAX_START_DELAY_FRAMES) ? (unsigned int)delay : MAX_START_DELAY_FRAMES;
+        monitor->delayPosition = 0;
+        memset(monitor->delayLine, 0, sizeof(monitor->delayLine));
+        monitor->started = true;
+        PushAudioEvent((AudioEvent){ AUDIO_EVENT_STARTED, monitor->id, blockClock + monitor->delayFrames,
+                                     monitor->startFrame });
+    }
+
+    // Everything below works on the clock this block will be heard at
+    unsigned long long outputClock = clock + monitor->callbackOffset + monitor->delayFrames;
+    unsigned long long played = atomic_load_explicit(&monitor->framesPlayed, memory_order_relaxed);
+    atomic_store_explicit(&monitor->anchorClock, (long long)outputClock - (long long)played, memory_order_relaxed);
+    unsigned int silentFrom = frames;
+
+    // Equal-power fade: the gain is sin of a phase that moves linearly, so an
+    // outgoing and an incoming stream fading together keep the power constant.
+    // A fade out waits for its clock; one with no length cuts on that exact frame
+    int direction = atomic_load_explicit(&monitor->fadeDirection, memory_order_acquire);
+    unsigned int fadeFrames = atomic_load_explicit(&monitor->fadeFrames, memory_order_relaxed);
+    if (direction < 0) {
+        unsigned long long fadeClock = atomic_load_explicit(&monitor->fadeClock, memory_order_relaxed);
+        if (fadeClock >= outputClock + frames) {
+            direction = 0;
+        } else if (fadeFrames == 0) {
+            silentFrom = (fadeClock > outputClock) ? (unsigned int)(fadeClock - outputClock) : 0;
+            monitor->fadePhase = 0.0f;
+            direction = 0;
+            atomic_store_explicit(&monitor->fadeDirection, 0, memory_order_relaxed);
+            PushAudioEvent((AudioEvent){ AUDIO_EVENT_FADED_OUT, monitor->id, outputClock + silentFrom, monitor->startFrame });
+        }
+    }
+    if (direction != 0) {
+        monitor->fadePhase += direction*(float)frames/(fadeFrames > 0 ? fadeFrames : 1);
+        if (monitor->fadePhase <= 0.0f || monitor->fadePhase >= 1.0f) {
+            monitor->fadePhase = (monitor->fadePhase <= 0.0f) ? 0.0f : 1.0f;
+            atomic_compare_exchange_strong(&monitor->fadeDirection, &direction, 0);
+            if (monitor->fadePhase == 0.0f) {
+                PushAudioEvent((AudioEvent){ AUDIO_EVENT_FADED_OUT, monitor->id, outputClock + frames, monitor->startFrame });
+            }
+        }
+    }
+    float fadeGain = (monitor->fadePhase >= 1.0f) ? 1.0f : sinf(monitor->fadePhase*PI/2.0f);
+
+    // Ramp over the block so intensity changes and fades do not click. A scheduled
+    // intensity change splits the block and ramps from its exact frame
+    float targetGain = GetStemCurveGain(monitor->curve, GetCombatIntensity())*fadeGain;
+    unsigned long long scheduledClock = atomic_load_explicit(&scheduledIntensityClock, memory_order_acquire);
+    if (scheduledClock != 0 && scheduledClock < outputClock + frames) {
+        unsigned int split = (scheduledClock > outputClock) ? (unsigned int)(scheduledClock - outputClock) : 0;
+        float scheduledGain = GetStemCurveGain(monitor->curve, atomic_load_explicit(&scheduledIntensity, memory_order_relaxed))*fadeGain;
+        ApplyGainRamp(samples, split, monitor->gain, targetGain);
+        ApplyGainRamp(samples + split*DEVICE_CHANNELS, frames - split, split > 0 ? targetGain : monitor->gain, scheduledGain);
+        targetGain = scheduledGain;
+    } else {
+        ApplyGainRamp(samples, frames, monitor->gain, targetGain);
+    }
+    monitor->gain = targetGain;
+
+    if (atomic_load_explicit(&monitor->ended, memory_order_relaxed)) {
+        // Past the end the decoder has wrapped around to the start
+        silentFrom = 0;
+    } else {
+        unsigned long long endFrame = (unsigned long long)monitor->frameCount*GetDeviceSampleRate()/monitor->stream.sampleRate;
+        if (played + frames >= endFrame) {
+            unsigned int offset = (endFrame > played) ? (unsigned int)(endFrame - played) : 0;
+            if (offset < silentFrom) silentFrom = offset;
+            atomic_store_explicit(&monitor->ended, true, memory_order_relaxed);
+            PushAudioEvent((AudioEvent){ AUDIO_EVENT_END_OF_STREAM, monitor->id, outputClock + offset, monitor->frameCount });
+        }
+    }
+    if (silentFrom < frames) {
+        memset(samples + silentFrom*DEVICE_CHANNELS, 0, (frames - silentFrom)*DEVICE_CHANNELS*sizeof(float));
+    }
+
+    // Swap the block through the delay line, which starts out silent
+    if (monitor->delayFrames > 0) {
+        for (unsigned int i = 0; i < frames; i++) {
+            float *delayed = &monitor->delayLine[monitor->delayPosition*DEVICE_CHANNELS];
+            for (int c = 0; c < DEVICE_CHANNELS; c++) {
+                float sample = samples[i*DEVICE_CHANNELS + c];
+                samples[i*DEVICE_CHANNELS + c] = delayed[c];
+                delayed[c] = sample;
+            }
+            monitor->delayPosition = (monitor->delayPosition + 1) % monitor->delayFrames;
+        }
+    }
+
+    // Hand the block to the mixed processor and give raylib silence to add
+    unsigned int offset = monitor->callbackOffset;
+    if (offset + frames <= MAX_MIX_BLOCK_FRAMES) {
+        if (mixClock != clock) {
+            mixClock = clock;
+            mixInputCount = 0;
+        }
+        if (offset == 0) {
+            mixInputs[mixInputCount++] = monitor;
+            monitor->mixFrames = 0;
+        }
+        if (monitor->mixFrames == offset) {
+            memcpy(monitor->mixBlock + offset*DEVICE_CHANNELS, samples, frames*DEVICE_CHANNELS*sizeof(float));
+            memset(samples, 0, frames*DEVICE_CHANNELS*sizeof(float));
+            monitor->mixFrames = offset + frames;
+        }
+    }
+
+    atomic_store_explicit(&monitor->framesPlayed, played + frames, memory_order_relaxed);
+    monitor->callbackOffset += frames;
+}
+
+// raylib processors get no user pointer, so each monitor slot has its own entry point
+#define STREAM_PROCESSOR(i) \
+    static void StreamProcessor##i(void *buffer, unsigned int frames) { ProcessMonitoredStream(&monitors[i], (float *)buffer, frames); }
+STREAM_PROCESSOR(0)  STREAM_PROCESSOR(1)  STREAM_PROCESSOR(2)  STREAM_PROCESSOR(3)
+STREAM_PROCESSOR(4)  STREAM_PROCESSOR(5)  STREAM_PROCESSOR(6)  STREAM_PROCESSOR(7)
+STREAM_PROCESSOR(8)  STREAM_PROCESSOR(9)  STREAM_PROCESSOR(10) STREAM_PROCESSOR(11)
+STREAM_PROCESSOR(12) STREAM_PROCESSOR(13) STREAM_PROCESSOR(14) STREAM_PROCESSOR(15)
+STREAM_PROCESSOR(16) STREAM_PROCESSOR(17) STREAM_PROCESSOR(18) STREAM_PROCESSOR(19)
+STREAM_PROCESSOR(20) STREAM_PROCESSOR(21) STREAM_PROCESSOR(22) STREAM_PROCESSOR(23)
+STREAM_PROCESSOR(24) STREAM_PROCESSOR(25) STREAM_PROCESSOR(26) STREAM_PROCESSOR(27)
+STREAM_PROCESSOR(28) STREAM_PROCESSOR(29) STREAM_PROCESSOR(30) STREAM_PROCESSOR(31)
+
+static const AudioCallback streamProcessors[MAX_STREAM_MONITORS] = {
+    StreamProcessor0,  StreamProcessor1,  StreamProcessor2,  StreamProcessor3,
+    StreamProcessor4,  StreamProcessor5,  StreamProcessor6,  StreamProcessor7,
+    StreamProcessor8,  StreamProcessor9,  StreamProcessor10, StreamProcessor11,
+    StreamProcessor12, StreamProcessor13, StreamProcessor14, StreamProcessor15,
+    StreamProcessor16, StreamProcessor17, StreamProcessor18, StreamProcessor19,
+    StreamProcessor20, StreamProcessor21, StreamProcessor22, StreamProcessor23,
+    StreamProcessor24, StreamProcessor25, StreamProcessor26, StreamProcessor27,
+    StreamProcessor28, StreamProcessor29, StreamProcessor30, StreamProcessor31
+};
+
+static StreamMonitor *FindStreamMonitor(int id) {
+    if (id <= 0) return NULL;
+    for (int i = 0; i < MAX_STREAM_MONITORS; i++) {
+        if (monitors[i].id == id) return &monitors[i];
+    }
+    return NULL;
+}
+
+int AttachStreamMonitor(Music music, StemCurve curve, unsigned int startFrame, float fadeInSeconds,
+                        unsigned long long startClock) {
+    if (music.ctxData == NULL || music.stream.sampleRate == 0) return 0;
+
+    for (int i = 0; i < MAX_STREAM_MONITORS; i++) {
+        StreamMonitor *monitor = &monitors[i];
+        if (monitor->id != 0) continue;
+
+        // Attaching takes the audio lock, which publishes these to the audio thread
+        monitor->id = nextMonitorId++;
+        monitor->stream = music.stream;
+        monitor->curve = curve;
+        monitor->fadePhase = (fadeInSeconds > 0.0f) ? 0.0f : 1.0f;
+        monitor->gain = GetStemCurveGain(curve, GetCombatIntensity())*monitor->fadePhase;
+        atomic_store(&monitor->fadeFrames, (unsigned int)(fadeInSeconds*GetDeviceSampleRate()));
+        atomic_store(&monitor->fadeClock, 0);
+        atomic_store(&monitor->fadeDirection, (fadeInSeconds > 0.0f) ? 1 : 0);
+        monitor->frameCount = music.frameCount;
+        monitor->startFrame = startFrame;
+        monitor->startClock = startClock;
+        monitor->delayFrames = 0;
+        monitor->started = false;
+        monitor->callbackClock = 0;
+        monitor->callbackOffset = 0;
+        atomic_store(&monitor->framesPlayed, (unsigned long long)startFrame*GetDeviceSampleRate()/music.stream.sampleRate);
+        atomic_store(&monitor->ended, false);
+        AttachAudioStreamProcessor(music.stream, streamProcessors[i]);
+        return monitor->id;
+    }
+
+    printf("Warning: No free stream monitor, end of stream will not be detected\n");
+    return 0;
+}
+
+void DetachStreamMonitor(int id) {
+    StreamMonitor *monitor = FindStreamMonitor(id);
+    if (monitor == NULL) return;
+
+    DetachAudioStreamProcessor(monitor->stream, streamProcessors[monitor - monitors]);
+    monitor->id = 0;
+}
+
+void FadeOutStreamMonitor(int id, float seconds, unsigned long long clock) {
+    StreamMonitor *monitor = FindStreamMonitor(id);
+    if (monitor == NULL) return;
+
+    // Length and clock are published by the direction store; a fade in still
+    // running turns around from wherever it got to
+    atomic_store_explicit(&monitor->fadeFrames, (unsigned int)(seconds*GetDeviceSampleRate()), memory_order_relaxed);
+    atomic_store_explicit(&monitor->fadeClock, clock, memory_order_relaxed);
+    atomic_store_explicit(&monitor->fadeDirection, -1, memory_order_release);
+}
+
+bool GetStreamMonitorAnchor(int id, long long *anchorClock) {
+    StreamMonitor *monitor = FindStreamMonitor(id);
+    if (monitor == NULL || !monitor->started) return false;
+    *anchorClock = atomic_load_explicit(&monitor->anchorClock, memory_order_relaxed);
+    return true;
+}
+
+unsigned long long GetStreamMonitorFrames(int id) {
+    StreamMonitor *monitor = FindStreamMonitor(id);
+    return monitor ? atomic_load_explicit(&monitor->framesPlayed, memory_order_relaxed) : 0;
+}
+
+float GetStreamBufferSeconds(Music music, int bufferFrames) {
+    // Two sub-buffers are queued after every refill
+    if (bufferFrames <= 0 || music.stream.sampleRate == 0) return 2*DEFAULT_SUB_BUFFER_SECONDS;
+    return 2.0f*bufferFrames/(float)music.stream.sampleRate;
+}
+
+bool UpdateMonitoredStream(Music music, int bufferFrames, StreamHealth *health) {
+    double now = GetTime();
+    bool starved = false;
+
+    // If the gap since the last refill is longer than everything that was queued,
+    // the device has drained the stream and played silence in between
+    if (health->lastUpdate > 0.0 && IsMusicStreamPlaying(music)) {
+        double gap = now - health->lastUpdate;
+        if (gap > GetStreamBufferSeconds(music, bufferFrames)) {
+            health->underruns++;
+            health->lastGap = gap;
+            starved = true;
+        }
+    }
+
+    UpdateMusicStream(music);
+    health->lastUpdate = now;
+    return starved;
+}
+
+void ResetStreamHealth(StreamHealth *health) {
+    health->lastUpdate = 0.0;
+    health->lastGap = 0.0;
+}
+
+int GrowBufferFrames(int bufferFrames, unsigned int sampleRate) {
+    // Start from the power of two above raylib's default when no size was set
+    if (bufferFrames <= 0) {
+        int defaultFrames = (int)(sampleRate*DEFAULT_SUB_BUFFER_SECONDS);
+        bufferFrames = MIN_STREAM_BUFFER_FRAMES;
+        while (bufferFrames < defaultFrames) bufferFrames *= 2;
+    }
+    bufferFrames *= 2;
+    return bufferFrames > MAX_STREAM_BUFFER_FRAMES ? MAX_STREAM_BUFFER_FRAMES : bufferFrames;
+}
+
+int ClampBufferFrames(int bufferFrames) {
+    if (bufferFrames <= 0) return 0;
+    if (bufferFrames < MIN_STREAM_BUFFER_FRAMES) return MIN_STREAM_BUFFER_FRAMES;
+    if (bufferFrames > MAX_STREAM_BUFFER_FRAMES) return MAX_STREAM_BUFFER_FRAMES;
+    return bufferFrames;
+}
+
+float ReadWaveSample(const Wave *wave, size_t index) {
+    switch (wave->sampleSize) {
+        case 8: return (((unsigned char *)wave->data)[index] - 128)/128.0f;
+        case 16: return ((short *)wave->data)[index]/32768.0f;
+        case 32: return ((float *)wave->data)[index];
+        default: return 0.0f;
+    }
+}
+
+void ReadWaveSamples(const Wave *wave, size_t first, float *dst, int count) {
+    if (wave->sampleSize == 16) {
+        dsp.Int16ToFloat(dst, (const int16_t *)wave->data + first, count);
+        return;
+    }
+    for (int i = 0; i < count; i++) dst[i] = ReadWaveSample(wave, first + i);
+}
+
+int PickAdaptiveBufferFrames(void) {
+    // Smallest size that has not starved within the window
+    double now = GetTime();
+    int frames = MIN_STREAM_BUFFER_FRAMES;
+    for (int i = 0; i < ADAPTIVE_BUFFER_SIZES; i++, frames *= 2) {
+        if (adaptiveUnderrunTime[i] == 0.0 || now - adaptiveUnderrunTime[i] > ADAPTIVE_BUFFER_WINDOW) return frames;
+    }
+    return MAX_STREAM_BUFFER_FRAMES;
+}
+
+void NoteAdaptiveUnderrun(int bufferFrames) {
+    // Anything smaller than a size that starved would have starved too
+    double now = GetTime();
+    int frames = MIN_STREAM_BUFFER_FRAMES;
+    for (int i = 0; i < ADAPTIVE_BUFFER_SIZES && frames <= bufferFrames; i++, frames *= 2) {
+        adaptiveUnderrunTime[i] = now;
+    }
+}
+
+void RecordUnderrun(const char *level, const char *segment, const char *layer, float gapMs, float bufferMs) {
+    UnderrunEvent *event = &underrunLog[underrunTotal % MAX_UNDERRUN_EVENTS];
+    event->time = GetTime();
+    snprintf(event->level, sizeof(event->level), "%s", level);
+    snprintf(event->segment, sizeof(event->segment), "%s", segment);
+    snprintf(event->layer, sizeof(event->layer), "%s", layer);
+    event->gapMs = gapMs;
+    event->bufferMs = bufferMs;
+    underrunTotal++;
+
+    printf("Underrun at %.2fs: '%s' / '%s' (%s) starved for %.1f ms, buffer holds %.1f ms\n",
+           event->time, event->level, event->segment, event->layer, gapMs, bufferMs);
+}
+
+int GetUnderrunCount(void) {
+    return underrunTotal;
+}
+
+int GetUnderrunEvents(UnderrunEvent *events, int maxEvents) {
+    // Copies the most recent events, oldest first
+    int available = underrunTotal < MAX_UNDERRUN_EVENTS ? underrunTotal : MAX_UNDERRUN_EVENTS;
+    int count = available < maxEvents ? available : maxEvents;
+    for (int i = 0; i < count; i++) {
+        events[i] = underrunLog[(underrunTotal - count + i) % MAX_UNDERRUN_EVENTS];
+    }
+    return count;
+}
+
+void RecordSeekLatency(float latencyMs) {
+    seekCount++;
+    seekLatencyTotal += latencyMs;
+    if (latencyMs > seekLatencyMax) seekLatencyMax = latencyMs;
+}
+
+void RecordPlayLatency(float latencyMs, bool prefetched) {
+    playCount[prefetched]++;
+    playLatencyTotal[prefetched] += latencyMs;
+    if (latencyMs > playLatencyMax[prefetched]) playLatencyMax[prefetched] = latencyMs;
+}
+
+void RecordDecoderCacheLookup(bool hit) {
+    decoderLookups++;
+    decoderHits += hit;
+}
+
+void RecordDecoderCacheEviction(void) {
+    decoderEvictions++;
+}
+
+void RecordOpenStreamFiles(int files) {
+    if (files > openStreamFilesMax) openStreamFilesMax = files;
+}
+
+void RecordReadAheadHint(void) {
+    readAheadHints++;
+}
+
+void RecordPreloadFootprint(size_t bytes, int files, int skipped) {
+    preloadFootprint = bytes;
+    preloadFiles = files;
+    preloadSkipped = skipped;
+}
+
+void RecordTimeToFirstAudio(float seconds, bool resumed) {
+    firstAudioSeconds = seconds;
+    firstAudioResumed = resumed;
+}
+
+void RecordStreamUpdateTime(double seconds, bool crossfading) {
+    streamUpdateTotal[crossfading] += seconds;
+    streamUpdateCount[crossfading]++;
+    if (seconds > streamUpdateMax[crossfading]) streamUpdateMax[crossfading] = seconds;
+}
+
+void PrintEngineStats(void) {
+    printf("Audio stats:\n");
+    const char *updateLabels[2] = { "stream updates", "stream updates while crossfading" };
+    for (int i = 0; i < 2; i++) {
+        if (streamUpdateCount[i] == 0) continue;
+        printf("  %s: %.2f ms average, %.2f ms max over %d frames\n", updateLabels[i],
+               streamUpdateTotal[i]*1000.0/streamUpdateCount[i], streamUpdateMax[i]*1000.0, streamUpdateCount[i]);
+    }
+    if (seekCount > 0) {
+        printf("  seeks: %d, latency %.1f ms average, %.1f ms max\n",
+               seekCount, seekLatencyTotal/seekCount, seekLatencyMax);
+    }
+    const char *playLabels[2] = { "cold level starts", "prefetched level starts" };
+    for (int i = 0; i < 2; i++) {
+        if (playCount[i] == 0) continue;
+        printf("  %s: %d, latency %.1f ms average, %.1f ms max\n", playLabels[i],
+               playCount[i], playLatencyTotal[i]/playCount[i], playLatencyMax[i]);
+    }
+    if (decoderLookups > 0 || decoderEvictions > 0) {
+        printf("  decoder cache: %d switches, %.0f%% warm, %d evictions, %d stream files open at most\n", decoderLookups,
+               decoderLookups > 0 ? 100.0f*decoderHits/decoderLookups : 0.0f, decoderEvictions, openStreamFilesMax);
+    }
+    if (readAheadHints > 0) printf("  read-ahead: %d files hinted\n", readAheadHints);
+    if (preloadFiles >= 0) {
+        printf("  preloaded audio: %d files, %.1f MB, %d left on disk\n", preloadFiles,
+               preloadFootprint/(1024.0*1024.0), preloadSkipped);
+    }
+    if (firstAudioSeconds >= 0.0f) {
+        printf("  time to first audio: %.3f s (%s)\n", firstAudioSeconds, firstAudioResumed ? "resumed session" : "user pick");
+    }
+    printf("  underruns: %d\n", underrunTotal);
+
+    UnderrunEvent events[MAX_UNDERRUN_EVENTS];
+    int count = GetUnderrunEvents(events, MAX_UNDERRUN_EVENTS);
+    for (int i = 0; i < count; i++) {
+        printf("    %.2fs '%s' / '%s' (%s) %.1f ms\n",
+               events[i].time, events[i].level, events[i].segment, events[i].layer, events[i].gapMs);
+    }
+}
@@ -0,0 +1,184 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include "raylib.h"
+#include "dsp.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// raylib sizes a stream's sub-buffers to 1/30 s of audio when no default is set,
+// and every stream is double buffered
+#define DEFAULT_SUB_BUFFER_SECONDS (1.0f/30.0f)
+#define MIN_STREAM_BUFFER_FRAMES 512
+#define MAX_STREAM_BUFFER_FRAMES 32768
+
+// Adaptive sizing steps through powers of two between the limits above and
+// forgets an underrun after this many seconds
+#define ADAPTIVE_BUFFER_SIZES 7
+#define ADAPTIVE_BUFFER_WINDOW 120.0
+
+#define MAX_UNDERRUN_EVENTS 64
+
+// raylib mixes in 32-bit float stereo at the device rate. The rate is not exposed,
+// so it is measured against GetTime() and snapped to a standard rate
+#define DEVICE_CHANNELS 2
+#define ASSUMED_DEVICE_SAMPLE_RATE 48000
+
+// Streams that can be monitored on the audio thread at the same time
+#define MAX_STREAM_MONITORS 32
+
+// Monitored streams are summed by the mixed processor in blocks of up to this many
+// frames; a device callback longer than that leaves the rest to raylib's mixer
+#define MAX_MIX_BLOCK_FRAMES 4096
+
+// Longest a stream scheduled on the audio clock can be held back before it starts
+#define MAX_START_DELAY_FRAMES 8192
+#define MAX_AUDIO_EVENTS 64
+
+// Mono copy of the mixed output for analysis, power of two
+#define OUTPUT_TAP_FRAMES 16384
+
+typedef enum AudioEventType {
+    AUDIO_EVENT_END_OF_STREAM = 0,
+    AUDIO_EVENT_STARTED,            // first block of a monitored stream reached the mixer
+    AUDIO_EVENT_FADED_OUT,          // a fade out reached silence
+} AudioEventType;
+
+// How a monitored stream follows the combat intensity: full gain at its peak,
+// fading linearly to silence at the neighbouring stems' peaks. A side without a
+// neighbour (low or high equal to peak) stays at full gain.
+typedef struct StemCurve {
+    float gain;
+    float low;
+    float peak;
+    float high;
+} StemCurve;
+
+// Shared-memory record written by an external game or telemetry process and read
+// by the audio thread once per device callback. The single writer bumps sequence
+// to an odd value, updates the fields, then bumps it to the next even value.
+#define INTENSITY_CHANNEL_MAGIC 0x31504c55     // "ULP1"
+#define INTENSITY_CHANNEL_VERSION 1
+
+typedef struct IntensityChannel {
+    uint32_t magic;
+    uint32_t version;
+    _Atomic uint32_t sequence;
+    _Atomic float intensity;        // 0 = free, 1 = full combat
+    _Atomic int32_t level;          // requested level, -1 = none
+    _Atomic int32_t segment;        // requested segment, -1 = none
+    _Atomic uint32_t request;       // bumped once per level/segment request
+} IntensityChannel;
+
+typedef struct IntensitySnapshot {
+    uint32_t sequence;
+    float intensity;
+    int level;
+    int segment;
+    uint32_t request;
+} IntensitySnapshot;
+
+// Posted by the audio thread, consumed by the main loop
+typedef struct AudioEvent {
+    AudioEventType type;
+    int monitor;                    // id returned by AttachStreamMonitor
+    unsigned long long clock;       // device frame the event happened on
+    unsigned long long frame;       // stream frame the event happened on
+} AudioEvent;
+
+// Per-stream bookkeeping for the feeding side of a Music stream
+typedef struct StreamHealth {
+    double lastUpdate;      // GetTime() of the previous UpdateMusicStream, 0 = not primed
+    double lastGap;         // seconds between the two updates that starved
+    int underruns;
+} StreamHealth;
+
+typedef struct UnderrunEvent {
+    double time;
+    char level[64];
+    char segment[64];
+    char layer[16];
+    float gapMs;
+    float bufferMs;
+} UnderrunEvent;
+
+// Stream feeding
+float GetStreamBufferSeconds(Music music, int bufferFrames);
+bool UpdateMonitoredStream(Music music, int bufferFrames, StreamHealth *health);
+void ResetStreamHealth(StreamHealth *health);
+int GrowBufferFrames(int bufferFrames, unsigned int sampleRate);
+int ClampBufferFrames(int bufferFrames);
+
+// Sample index of a decoded Wave (frame*channels + channel) as float, for analysis
+float ReadWaveSample(const Wave *wave, size_t index);
+// count samples from first on, 16-bit waves through the conversion kernel
+void ReadWaveSamples(const Wave *wave, size_t first, float *dst, int count);
+
+// Adaptive buffer sizing
+int PickAdaptiveBufferFrames(void);
+void NoteAdaptiveUnderrun(int bufferFrames);
+
+// Audio clock
+void InitAudioClock(void);
+void CloseAudioClock(void);
+void UpdateAudioClock(void);
+unsigned long long GetAudioClock(void);
+unsigned int GetDeviceSampleRate(void);
+
+// The audio thread only writes the tap while it is enabled. Reading copies the
+// newest frames and fails if the tap has fewer or the writer lapped the copy
+void SetOutputTapEnabled(bool enabled);
+bool ReadOutputTap(float *dst, int frames);
+
+// Stream monitors count the frames a stream hands to the mixer and silence it
+// past its last frame, so streams are played with looping on and end here
+// startClock holds the stream back until that device clock (up to
+// MAX_START_DELAY_FRAMES), so it starts on the exact frame; 0 starts it at once.
+// Returns 0, like a stem without a monitor, if the stream is not loaded or all are taken
+int AttachStreamMonitor(Music music, StemCurve curve, unsigned int startFrame, float fadeInSeconds,
+                        unsigned long long startClock);
+// Equal-power fade to silence from a device clock (0 = now); no length cuts on that frame
+void FadeOutStreamMonitor(int monitor, float seconds, unsigned long long clock);
+// Device clock the stream's first frame is heard on, valid once it has started;
+// with the device rate this maps any track position to the clock
+bool GetStreamMonitorAnchor(int monitor, long long *anchorClock);
+void DetachStreamMonitor(int monitor);
+unsigned long long GetStreamMonitorFrames(int monitor);
+bool PollAudioEvent(AudioEvent *event);
+
+// Combat intensity, applied as layer gains on the audio thread
+float GetStemCurveGain(StemCurve curve, float intensity);
+void SetCombatIntensity(float intensity);
+float GetCombatIntensity(void);
+// Switches to intensity on the exact device clock; 0 cancels a pending switch
+void ScheduleCombatIntensity(float intensity, unsigned long long clock);
+// Returns once the audio thread no longer reads the previous channel
+void SetIntensityChannel(IntensityChannel *channel);
+bool ReadIntensityChannel(IntensityChannel *channel, IntensitySnapshot *snapshot);
+
+// Underrun log
+void RecordUnderrun(const char *level, const char *segment, const char *layer, float gapMs, float bufferMs);
+int GetUnderrunCount(void);
+int GetUnderrunEvents(UnderrunEvent *events, int maxEvents);
+
+// Seek latency, from the request to the new position reaching the mixer
+void RecordSeekLatency(float latencyMs);
+// From a level click to its first frame reaching the mixer, split by whether a
+// hover had prefetched it
+void RecordPlayLatency(float latencyMs, bool prefetched);
+// Segment switches that found the streams open, and segments closed to make room
+void RecordDecoderCacheLookup(bool hit);
+void RecordDecoderCacheEviction(void);
+void RecordOpenStreamFiles(int files);
+void RecordReadAheadHint(void);
+// Audio read into memory at startup, and files left on disk
+void RecordPreloadFootprint(size_t bytes, int files, int skipped);
+// From window open to the first segment reaching the mixer
+void RecordTimeToFirstAudio(float seconds, bool resumed);
+// Main loop time spent feeding streams, kept apart while two segments overlap
+void RecordStreamUpdateTime(double seconds, bool crossfading);
+
+void PrintEngineStats(void);
+
+#endif
@@ -0,0 +1,357 @@
+#include "control.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+typedef struct ControlClient {
+    int fd;                         // -1 = free slot
+    char line[CONTROL_LINE_LENGTH];
+    int lineLength;
+} ControlClient;
+
+static int listenFd = -1;
+static char socketPath[108];
+static ControlClient clients[MAX_CONTROL_CLIENTS];
+
+// Last state sent to clients, so events only go out on changes
+static struct {
+    int level;
+    int segment;
+    bool paused;
+    bool combat;
+    bool repeat;
+} lastStatus = { -2, -2, false, false, false };
+
+static void SetNonBlocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+bool InitControlSocket(const char *path) {
+    struct sockaddr_un addr = { 0 };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("Error: Control socket path too long: %s\n", path);
+        return false;
+    }
+
+    for (int i = 0; i < MAX_CONTROL_CLIENTS; i++) clients[i].fd = -1;
+
+    // Clients going away must not kill the player
+    signal(SIGPIPE, SIG_IGN);
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+        printf("Error: Could not create control socket\n");
+        return false;
+    }
+
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listenFd, MAX_CONTROL_CLIENTS) < 0) {
+        printf("Error: Could not listen on %s\n", path);
+        close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+    SetNonBlocking(listenFd);
+    snprintf(socketPath, sizeof(socketPath), "%s", path);
+
+    printf("Control socket listening on %s\n", path);
+    return true;
+}
+
+static void DropClient(ControlClient *client) {
+    close(client->fd);
+    client->fd = -1;
+    client->lineLength = 0;
+}
+
+static void SendLine(ControlClient *client, const char *text) {
+    size_t length = strlen(text);
+    if (send(client->fd, text, length, 0) != (ssize_t)length) DropClient(client);
+}
+
+static void FormatStatus(AppState *state, char *text, int size) {
+    if (state->currentPlaying == -1) {
+        snprintf(text, size, "status stopped paused=%d combat=%d repeat=%d\n",
+                 state->isPaused, state->persistentCombat, state->repeatSegment);
+        return;
+    }
+
+    Level *level = &state->levels[state->currentPlaying];
+    Segment *seg = &level->segments[level->currentSegment];
+    snprintf(text, size, "status level=%d segment=%d paused=%d combat=%d repeat=%d position=%.3f length=%.3f name=\"%s\" title=\"%s\"\n",
+             state->currentPlaying, level->currentSegment, state->isPaused, state->persistentCombat, state->repeatSegment,
+             GetMusicTimePlayed(seg->stems[0].music), GetMusicTimeLength(seg->stems[0].music), level->name, seg->name);
+}
+
+// "on"/"off" set the flag, no argument toggles it
+static void PushSwitch(AppState *state, const char *arg, PlaybackCommandType setType, PlaybackCommandType toggleType) {
+    if (arg == NULL) PushPlaybackCommand(state, toggleType, 0, 0);
+    else PushPlaybackCommand(state, setType, strcmp(arg, "on") == 0 || strcmp(arg, "1") == 0, 0);
+}
+
+// Whole argument in base 10, and 0 <= index < count
+static bool ParseIndex(const char *arg, int count, int *index) {
+    char *end;
+    errno = 0;
+    long value = strtol(arg, &end, 10);
+    if (end == arg || *end != '\0' || errno != 0 || value < 0 || value >= count) return false;
+    *index = (int)value;
+    return true;
+}
+
+// Seconds into the master stem as a frame, clamped to its last frame
+static bool ParseSeekFrame(const char *arg, Music master, int *frame) {
+    char *end;
+    double seconds = strtod(arg, &end);
+    if (end == arg || *end != '\0' || !isfinite(seconds) || seconds < 0.0) return false;
+    if (master.stream.sampleRate == 0 || master.frameCount == 0) return false;
+    double frames = seconds*master.stream.sampleRate;
+    *frame = (frames < master.frameCount - 1) ? (int)frames : (int)(master.frameCount - 1);
+    return true;
+}
+
+static void HandleControlLine(AppState *state, ControlClient *client, char *line) {
+    char *command = strtok(line, " \t\r");
+    char *arg1 = strtok(NULL, " \t\r");
+    char *arg2 = strtok(NULL, " \t\r");
+    if (command == NULL) return;
+
+    if (strcmp(command, "play") == 0 && arg1 != NULL) {
+        int level, segment = 0;
+        if (!ParseIndex(arg1, state->levelCount, &level) ||
+            (arg2 != NULL && !ParseIndex(arg2, state->levels[level].segmentCount, &segment))) {
+            SendLine(client, "error invalid argument\n");
+            return;
+        }
+        PushPlaybackCommand(state, PLAYBACK_PLAY_LEVEL, level, segment);
+    } else if (strcmp(command, "segment") == 0 && arg1 != NULL) {
+        // Of the level playing now, or of one a "play" earlier in this frame starts
+        int level = state->currentPlaying;
+        for (int i = 0; i < state->commandCount; i++) {
+            if (state->commands[i].type == PLAYBACK_PLAY_LEVEL) level = state->commands[i].a;
+        }
+        int segment;
+        int segmentCount = (level != -1) ? state->levels[level].segmentCount : 0;
+        if (!ParseIndex(arg1, segmentCount, &segment)) {
+            SendLine(client, "error invalid argument\n");
+            return;
+        }
+        PushPlaybackCommand(state, PLAYBACK_PLAY_SEGMENT, segment, 0);
+    } else if (strcmp(command, "next") == 0) {
+        PushPlaybackCommand(state, PLAYBACK_NEXT, 0, 0);
+    } else if (strcmp(command, "previous") == 0 || strcmp(command, "prev") == 0) {
+        PushPlaybackCommand(state, PLAYBACK_PREVIOUS, 0, 0);
+    } else if (strcmp(command, "pause") == 0) {
+        PushSwitch(state, arg1, PLAYBACK_SET_PAUSE, PLAYBACK_TOGGLE_PAUSE);
+    } else if (strcmp(command, "combat") == 0) {
+        PushSwitch(state, arg1, PLAYBACK_SET_COMBAT, PLAYBACK_TOGGLE_COMBAT);
+    } else if (strcmp(command, "repeat") == 0) {
+        PushPlaybackCommand(state, PLAYBACK_TOGGLE_REPEAT, 0, 0);
+    } else if (strcmp(command, "seek") == 0 && arg1 != NULL && state->currentPlaying != -1) {
+        Level *level = &state->levels[state->currentPlaying];
+        int frame;
+        if (!ParseSeekFrame(arg1, level->segments[level->currentSegment].stems[0].music, &frame)) {
+            SendLine(client, "error invalid argument\n");
+            return;
+        }
+        PushPlaybackCommand(state, PLAYBACK_SEEK, frame, 0);
+    } else if (strcmp(command, "status") == 0) {
+        char status[CONTROL_LINE_LENGTH*2];
+        FormatStatus(state, status, sizeof(status));
+        SendLine(client, status);
+        return;
+    } else {
+        SendLine(client, "error unknown command\n");
+        return;
+    }
+    SendLine(client, "ok\n");
+}
+
+static void ReadClient(AppState *state, ControlClient *client) {
+    char buffer[CONTROL_LINE_LENGTH];
+    ssize_t received;
+    while (client->fd != -1 && (received = recv(client->fd, buffer, sizeof(buffer), 0)) != 0) {
+        if (received < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) DropClient(client);
+            return;
+        }
+
+        for (ssize_t i = 0; i < received && client->fd != -1; i++) {
+            if (buffer[i] == '\n') {
+                client->line[client->lineLength] = '\0';
+                client->lineLength = 0;
+                HandleControlLine(state, client, client->line);
+            } else if (client->lineLength < CONTROL_LINE_LENGTH - 1) {
+                client->line[client->lineLength++] = buffer[i];
+            }
+        }
+    }
+
+    // recv returned 0: client closed the connection
+    if (client->fd != -1 && received == 0) DropClient(client);
+}
+
+void PublishControlStatus(AppState *state) {
+    if (listenFd < 0) return;
+
+    int level = state->currentPlaying;
+    int segment = (level != -1) ? state->levels[level].currentSegment : -1;
+    if (level == lastStatus.level && segment == lastStatus.segment && state->isPaused == lastStatus.paused &&
+        state->persistentCombat == lastStatus.combat && state->repeatSegment == lastStatus.repeat) return;
+
+    lastStatus.level = level;
+    lastStatus.segment = segment;
+    lastStatus.paused = state->isPaused;
+    lastStatus.combat = state->persistentCombat;
+    lastStatus.repeat = state->repeatSegment;
+
+    char status[CONTROL_LINE_LENGTH*2];
+    FormatStatus(state, status, sizeof(status));
+    for (int i = 0; i < MAX_CONTROL_CLIENTS; i++) {
+        if (clients[i].fd != -1) SendLine(&clients[i], status);
+    }
+}
+
+void PollControlSocket(AppState *state) {
+    if (listenFd < 0) return;
+
+    int fd;
+    while ((fd = accept(listenFd, NULL, NULL)) >= 0) {
+        ControlClient *client = NULL;
+        for (int i = 0; i < MAX_CONTROL_CLIENTS && client == NULL; i++) {
+            if (clients[i].fd == -1) client = &clients[i];
+        }
+        if (client == NULL) {
+            close(fd);
+            continue;
+        }
+        SetNonBlocking(fd);
+        client->fd = fd;
+        client->lineLength = 0;
+
+        // New clients get the current state right away
+        char status[CONTROL_LINE_LENGTH*2];
+        FormatStatus(state, status, sizeof(status));
+        SendLine(client, status);
+    }
+
+    for (int i = 0; i < MAX_CONTROL_CLIENTS; i++) {
+        if (clients[i].fd != -1) ReadClient(state, &clients[i]);
+    }
+}
+
+void CloseControlSocket(void) {
+    if (listenFd < 0) return;
+
+    for (int i = 0; i < MAX_CONTROL_CLIENTS; i++) {
+        if (clients[i].fd != -1) DropClient(&clients[i]);
+    }
+    close(listenFd);
+    unlink(socketPath);
+    listenFd = -1;
+}
+
+static IntensityChannel *sharedChannel = NULL;
+static uint32_t lastSharedRequest = 0;
+static uint32_t lastSharedSequence = 0;
+
+bool InitSharedIntensity(const char *name) {
+    // Only this user's processes may drive playback
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0600);
+    if (fd < 0) {
+        printf("Error: Could not open shared memory %s\n", name);
+        return false;
+    }
+    if (ftruncate(fd, sizeof(IntensityChannel)) < 0) {
+        printf("Error: Could not size shared memory %s\n", name);
+        close(fd);
+        return false;
+    }
+    sharedChannel = mmap(NULL, sizeof(IntensityChannel), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (sharedChannel == MAP_FAILED) {
+        printf("Error: Could not map shared memory %s\n", name);
+        sharedChannel = NULL;
+        return false;
+    }
+
+    // A fresh segment is zero filled; stamp it so writers can check the layout
+    if (sharedChannel->magic != INTENSITY_CHANNEL_MAGIC) {
+        atomic_store(&sharedChannel->level, -1);
+        atomic_store(&sharedChannel->segment, -1);
+        sharedChannel->version = INTENSITY_CHANNEL_VERSION;
+        sharedChannel->magic = INTENSITY_CHANNEL_MAGIC;
+    }
+    lastSharedRequest = atomic_load(&sharedChannel->request);
+    lastSharedSequence = atomic_load(&sharedChannel->sequence);
+
+    SetIntensityChannel(sharedChannel);
+    printf("Intensity channel mapped at %s\n", name);
+    return true;
+}
+
+void PollSharedIntensity(AppState *state) {
+    if (sharedChannel == NULL) return;
+
+    IntensitySnapshot snapshot;
+    if (!ReadIntensityChannel(sharedChannel, &snapshot)) return;
+
+    // The audio thread applies a new intensity itself; the combat button follows it
+    // only when the writer changed something, so the C key and the button are not
+    // overwritten before their command is applied
+    if (snapshot.sequence != lastSharedSequence) {
+        lastSharedSequence = snapshot.sequence;
+        state->persistentCombat = snapshot.intensity >= 0.5f;
+    }
+
+    if (snapshot.request == lastSharedRequest) return;
+    lastSharedRequest = snapshot.request;
+
+    if (snapshot.level >= 0) {
+        PushPlaybackCommand(state, PLAYBACK_PLAY_LEVEL, snapshot.level, snapshot.segment);
+    } else if (snapshot.segment >= 0) {
+        PushPlaybackCommand(state, PLAYBACK_PLAY_SEGMENT, snapshot.segment, 0);
+    }
+}
+
+void CloseSharedIntensity(void) {
+    if (sharedChannel == NULL) return;
+
+    // The segment stays around for the writer; only the mapping goes
+    SetIntensityChannel(NULL);
+    munmap(sharedChannel, sizeof(IntensityChannel));
+    sharedChannel = NULL;
+}
+
+#else
+
+bool InitControlSocket(const char *path) {
+    printf("Warning: Control socket is not supported on this platform\n");
+    return false;
+}
+
+void PollControlSocket(AppState *state) { }
+void PublishControlStatus(AppState *state) { }
+
+bool InitSharedIntensity(const char *name) {
+    printf("Warning: Shared intensity channel is not supported on this platform\n");
+    return false;
+}
+
+void PollSharedIntensity(AppState *state) { }
+void CloseSharedIntensity(void) { }
+void CloseControlSocket(void) { }
+
+#endif
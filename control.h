@@ -0,0 +1,24 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include "functions.h"
+
+#define MAX_CONTROL_CLIENTS 8
+#define CONTROL_LINE_LENGTH 256
+
+// Local control socket: one command per line, replies and status events are lines too.
+//   play <level> [segment]   segment <index>   next   previous
+//   pause [on|off]           combat [on|off]   repeat   status
+//   seek <seconds>
+bool InitControlSocket(const char *path);
+void PollControlSocket(AppState *state);
+void PublishControlStatus(AppState *state);
+void CloseControlSocket(void);
+
+// Shared-memory intensity channel (see IntensityChannel in audio.h). The audio
+// thread follows the intensity; level/segment requests are queued from here
+bool InitSharedIntensity(const char *name);
+void PollSharedIntensity(AppState *state);
+void CloseSharedIntensity(void);
+
+#endif
@@ -0,0 +1,194 @@
+#include "decoders.h"
+#include "pack.h"
+#include "jobs.h"
+#include <stdio.h>
+#include <limits.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+static unsigned int decoderTick = 0;
+static const Segment *readAheadCurrent = NULL;
+static const Segment *readAheadNext = NULL;
+static int decoderPoolFiles = DECODER_POOL_FALLBACK_FILES;
+static bool rewarmPending = false;
+
+// What the open segments hold, kept by CountSegmentStreams
+static int decoderCacheFiles = 0;
+static size_t decoderCacheBytes = 0;
+
+// Streams decoded from memory (packed or preloaded stems) hold no file
+static int GetSegmentOpenFiles(const Segment *seg) {
+    int files = 0;
+    for (int i = 0; i < seg->stemCount; i++) {
+        const Stem *stem = &seg->stems[i];
+        files += (stem->music.ctxData != NULL && stem->fileBacked);
+    }
+    return files;
+}
+
+// Stream buffers; the decoders' own state is small next to them
+static size_t GetSegmentStreamBytes(const Segment *seg) {
+    size_t bytes = 0;
+    for (int i = 0; i < seg->stemCount; i++) {
+        const Stem *stem = &seg->stems[i];
+        Music music = stem->music;
+        if (music.ctxData == NULL) continue;
+        size_t frames = (size_t)(GetStreamBufferSeconds(music, seg->bufferFrames)*music.stream.sampleRate);
+        bytes += frames*music.stream.channels*(music.stream.sampleSize/8);
+    }
+    return bytes;
+}
+
+void CountSegmentStreams(Segment *seg) {
+    decoderCacheFiles -= seg->openFiles;
+    decoderCacheBytes -= seg->streamBytes;
+    seg->openFiles = seg->streamsLoaded ? GetSegmentOpenFiles(seg) : 0;
+    seg->streamBytes = seg->streamsLoaded ? GetSegmentStreamBytes(seg) : 0;
+    decoderCacheFiles += seg->openFiles;
+    decoderCacheBytes += seg->streamBytes;
+}
+
+void RewarmSegment(Segment *seg) {
+    seg->rewarm = true;
+    rewarmPending = true;
+}
+
+bool IsSegmentInUse(AppState *state, const Segment *seg) {
+    if (seg->stems[0].monitor != 0 || seg == state->fadingSegment || seg == state->prefetchSegment) return true;
+    if (state->currentPlaying != -1) {
+        Level *level = &state->levels[state->currentPlaying];
+        if (seg == &level->segments[level->currentSegment]) return true;
+    }
+    if (state->hasScheduledSwitch && seg == &state->levels[state->scheduledLevel].segments[state->scheduledSegment]) return true;
+    if (state->hasPendingNavigation && seg == &state->levels[state->pendingLevel].segments[state->pendingSegment]) return true;
+    return false;
+}
+
+void UseSegmentStreams(Segment *seg) {
+    seg->streamsUsed = ++decoderTick;
+}
+
+// Least recently played segment that is open and idle, NULL = none
+static Segment *FindEvictableSegment(AppState *state) {
+    Segment *oldest = NULL;
+    for (int i = 0; i < state->levelCount; i++) {
+        Level *level = &state->levels[i];
+        for (int j = 0; j < level->segmentCount; j++) {
+            Segment *seg = &level->segments[j];
+            if (!seg->streamsLoaded || IsSegmentInUse(state, seg)) continue;
+            if (oldest == NULL || seg->streamsUsed < oldest->streamsUsed) oldest = seg;
+        }
+    }
+    return oldest;
+}
+
+void InitDecoderPool(AppState *state) {
+    int available = DECODER_POOL_FALLBACK_FILES + DECODER_POOL_RESERVED_FILES;
+#ifdef _WIN32
+    // The C runtime's stdio limit, not the handle limit, is what runs out first
+    available = _getmaxstdio();
+#else
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        available = (limit.rlim_cur == RLIM_INFINITY || limit.rlim_cur > INT_MAX) ? INT_MAX : (int)limit.rlim_cur;
+    }
+#endif
+    decoderPoolFiles = available - DECODER_POOL_RESERVED_FILES;
+    if (state->maxOpenFiles > 0 && state->maxOpenFiles < decoderPoolFiles) decoderPoolFiles = state->maxOpenFiles;
+    if (decoderPoolFiles < DECODER_POOL_MIN_FILES) {
+        printf("Warning: only %d files can be open, streams may fail to open\n", available);
+        decoderPoolFiles = DECODER_POOL_MIN_FILES;
+    }
+
+    // Segments in use count against the pool but not the cache, so leave them room
+    int cacheLimit = decoderPoolFiles - DECODER_POOL_MIN_FILES;
+    if (state->decoderCacheFiles > cacheLimit) state->decoderCacheFiles = cacheLimit;
+    printf("Decoder pool: up to %d open files, %d kept warm\n", decoderPoolFiles, state->decoderCacheFiles);
+}
+
+bool CheckOutSegmentStreams(AppState *state, Segment *seg) {
+    if (seg->streamsLoaded) return true;
+
+    while (decoderCacheFiles + seg->stemCount > decoderPoolFiles) {
+        Segment *oldest = FindEvictableSegment(state);
+        if (oldest == NULL) {
+            printf("Warning: %d stream files open, cannot open segment '%s'\n", decoderCacheFiles, seg->name);
+            return false;
+        }
+        UnloadSegmentStreams(oldest);
+        RecordDecoderCacheEviction();
+    }
+    LoadSegmentStreams(seg, IsSegmentInUse(state, seg));
+    RecordOpenStreamFiles(decoderCacheFiles);
+    return true;
+}
+
+bool DecoderCacheHasRoom(AppState *state, const Segment *seg) {
+    return decoderCacheFiles + seg->stemCount <= state->decoderCacheFiles && decoderCacheBytes < state->decoderCacheBudget;
+}
+
+void UpdateDecoderCache(AppState *state) {
+    // Segments a switch stopped decode their start again now that the frame with
+    // the incoming segment is out, rather than in front of it
+    for (int i = 0; i < state->levelCount && rewarmPending; i++) {
+        for (int j = 0; j < state->levels[i].segmentCount; j++) {
+            Segment *seg = &state->levels[i].segments[j];
+            if (!seg->rewarm) continue;
+            seg->rewarm = false;
+            PrefetchSegment(state, seg);
+        }
+    }
+    rewarmPending = false;
+
+    while (decoderCacheFiles > state->decoderCacheFiles || decoderCacheBytes > state->decoderCacheBudget) {
+        Segment *oldest = FindEvictableSegment(state);
+        if (oldest == NULL) break;
+
+        UnloadSegmentStreams(oldest);
+        RecordDecoderCacheEviction();
+    }
+}
+
+static void ReadAheadJob(void *data) {
+    AdviseAssetReadAhead((const char *)data);
+}
+
+// False if the job queue was full, the segment is hinted again on a later frame
+static bool AdviseSegmentReadAhead(Segment *seg) {
+    for (int i = 0; i < seg->stemCount; i++) {
+        // Converted stems stream from their copy in the cache
+        const Stem *stem = &seg->stems[i];
+        const char *path = (stem->resampledFile != NULL) ? stem->resampledFile : stem->path;
+        // Ahead of analysis and preload work, or the hint lands after the switch
+        if (!SubmitUrgentJob(ReadAheadJob, (void *)path)) return false;
+        RecordReadAheadHint();
+    }
+    return true;
+}
+
+void UpdateReadAhead(AppState *state) {
+    if (state->currentPlaying == -1) return;
+
+    int level = state->currentPlaying;
+    int segment = state->levels[level].currentSegment;
+    Segment *current = &state->levels[level].segments[segment];
+    if (state->hasScheduledSwitch) {
+        level = state->scheduledLevel;
+        segment = state->scheduledSegment;
+    } else if (state->hasPendingNavigation) {
+        level = state->pendingLevel;
+        segment = state->pendingSegment;
+    } else if (!state->repeatSegment) {
+        StepPlaybackTarget(state, &level, &segment, 1);
+    }
+    Segment *next = &state->levels[level].segments[segment];
+    if (current == readAheadCurrent && next == readAheadNext) return;
+
+    // The current segment was usually hinted while it was the next one
+    bool currentHinted = current == readAheadCurrent || current == readAheadNext || AdviseSegmentReadAhead(current);
+    bool nextHinted = (next == current) ? currentHinted
+                    : next == readAheadCurrent || next == readAheadNext || AdviseSegmentReadAhead(next);
+    readAheadCurrent = currentHinted ? current : NULL;
+    readAheadNext = nextHinted ? next : NULL;
+}
@@ -0,0 +1,51 @@
+#ifndef DECODERS_H
+#define DECODERS_H
+
+#include "functions.h"
+
+// Segments keep their streams open after they stop, rewound with the first
+// buffers decoded, so going back to one starts it at once. Past the limits the
+// least recently played are closed down to their metadata
+#define DECODER_CACHE_DEFAULT_FILES 64
+#define DECODER_CACHE_DEFAULT_MB 64
+
+// Hard cap on stem files open at once, taken from the process file limit less
+// what the rest of the player may have open. Streams are only opened through
+// the pool, which closes idle segments first to stay under it
+#define DECODER_POOL_RESERVED_FILES 64
+#define DECODER_POOL_MIN_FILES (4*MAX_STEMS)     // playing, fading, scheduled and prefetched
+#define DECODER_POOL_FALLBACK_FILES 256          // when the limit cannot be read
+
+// Sizes the pool from "max-open-files" or the process limit, and fits the cache in it
+void InitDecoderPool(AppState *state);
+
+// Opens the segment's streams unless they are open, closing idle segments to make
+// room; false if the pool is full of segments in use
+bool CheckOutSegmentStreams(AppState *state, Segment *seg);
+
+// Playing, fading, about to be switched to, or prefetched for the tile under the mouse
+bool IsSegmentInUse(AppState *state, const Segment *seg);
+
+// Marks the segment as just played or prefetched
+void UseSegmentStreams(Segment *seg);
+
+// Recounts the segment's files and stream bytes in the cache totals; called
+// whenever its streams are opened, reopened or closed
+void CountSegmentStreams(Segment *seg);
+
+// Prefetched again on the next UpdateDecoderCache, once the frame that stopped it is out
+void RewarmSegment(Segment *seg);
+
+// Room for one more segment, for the background loader
+bool DecoderCacheHasRoom(AppState *state, const Segment *seg);
+
+// Prefetches segments a switch stopped, then closes idle segments, least
+// recently played first, until the cache fits
+void UpdateDecoderCache(AppState *state);
+
+// Read-ahead hints for the files of the playing segment and of the one after it
+// (the switch target, itself on repeat, or the next in order), issued on a job
+// worker whenever either changes
+void UpdateReadAhead(AppState *state);
+
+#endif
@@ -0,0 +1,761 @@
+#include "dsp.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#define DSP_X86 1
+#include <immintrin.h>
+// Target attributes and __builtin_cpu_supports are GNU extensions, so MSVC stays on SSE2
+#if defined(__GNUC__) || defined(__clang__)
+#define DSP_AVX2 1
+#endif
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#define DSP_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Bit-exactness relies on every path doing separate multiplies and adds
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+DspKernels dsp;
+
+// Scalar reference
+
+static void FloatToInt16Scalar(int16_t *dst, const float *src, int count) {
+    for (int i = 0; i < count; i++) {
+        float x = src[i]*32768.0f;
+        x = (x < -32768.0f) ? -32768.0f : x;
+        x = (x > 32767.0f) ? 32767.0f : x;
+        dst[i] = (int16_t)lrintf(x);
+    }
+}
+
+static void Int16ToFloatScalar(float *dst, const int16_t *src, int count) {
+    for (int i = 0; i < count; i++) dst[i] = (float)src[i]*(1.0f/32768.0f);
+}
+
+static void GainRampScalar(float *samples, int frames, int channels, float from, float to) {
+    float step = (to - from)/frames;
+    for (int i = 0; i < frames; i++) {
+        float gain = from + step*(float)(i + 1);
+        for (int c = 0; c < channels; c++) samples[i*channels + c] *= gain;
+    }
+}
+
+static void MixInputsScalar(float *dst, const float *const *inputs, const float *gains, int inputCount, int count) {
+    for (int i = 0; i < count; i++) {
+        float sum = 0.0f;
+        for (int k = 0; k < inputCount; k++) sum = sum + inputs[k][i]*gains[k];
+        dst[i] = sum;
+    }
+}
+
+static void ClampSamplesScalar(float *samples, int count, float limit) {
+    for (int i = 0; i < count; i++) {
+        float x = (samples[i] < -limit) ? -limit : samples[i];
+        samples[i] = (x > limit) ? limit : x;
+    }
+}
+
+static void SoftClipScalar(float *samples, int count) {
+    const float knee = DSP_SOFT_CLIP_KNEE;
+    const float range = 1.0f - knee;
+    const float scale = 1.0f/range;
+    for (int i = 0; i < count; i++) {
+        float a = fabsf(samples[i]);
+        float u = fmaxf(a - knee, 0.0f)*scale;
+        float y = fminf(a, knee) + range*(u/(1.0f + u));
+        samples[i] = copysignf(y, samples[i]);
+    }
+}
+
+// Eight partial sums, reduced pairwise, so every vector width adds in the same order
+static float ReduceLanes(const float *lanes) {
+    return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+}
+
+static float DotProductScalar(const float *a, const float *b, int count) {
+    float lanes[8] = { 0 };
+    for (int i = 0; i < count; i += 8) {
+        for (int j = 0; j < 8; j++) lanes[j] = lanes[j] + a[i + j]*b[i + j];
+    }
+    return ReduceLanes(lanes);
+}
+
+// Butterflies from j = first on; the vector versions finish their tails here
+static void ButterflyTail(float *re, float *im, const float *twiddleRe, const float *twiddleIm, int half, int first) {
+    for (int j = first; j < half; j++) {
+        float tr = re[j + half]*twiddleRe[j] - im[j + half]*twiddleIm[j];
+        float ti = re[j + half]*twiddleIm[j] + im[j + half]*twiddleRe[j];
+        re[j + half] = re[j] - tr;
+        im[j + half] = im[j] - ti;
+        re[j] = re[j] + tr;
+        im[j] = im[j] + ti;
+    }
+}
+
+static void ButterfliesScalar(float *re, float *im, const float *twiddleRe, const float *twiddleIm, int half) {
+    ButterflyTail(re, im, twiddleRe, twiddleIm, half, 0);
+}
+
+#if defined(DSP_X86)
+
+// SSE2, always available on x86-64
+
+static void FloatToInt16Sse2(int16_t *dst, const float *src, int count) {
+    const __m128 scale = _mm_set1_ps(32768.0f);
+    const __m128 low = _mm_set1_ps(-32768.0f);
+    const __m128 high = _mm_set1_ps(32767.0f);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128 a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + i), scale), low), high);
+        __m128 b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + i + 4), scale), low), high);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+    }
+    FloatToInt16Scalar(dst + i, src + i, count - i);
+}
+
+static void Int16ToFloatSse2(float *dst, const int16_t *src, int count) {
+    const __m128 scale = _mm_set1_ps(1.0f/32768.0f);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+    Int16ToFloatScalar(dst + i, src + i, count - i);
+}
+
+static void GainRampSse2(float *samples, int frames, int channels, float from, float to) {
+    if (channels != 2) {
+        GainRampScalar(samples, frames, channels, from, to);
+        return;
+    }
+
+    // Two stereo frames per vector
+    float step = (to - from)/frames;
+    const __m128 vstep = _mm_set1_ps(step);
+    const __m128 vfrom = _mm_set1_ps(from);
+    const __m128 two = _mm_set1_ps(2.0f);
+    __m128 index = _mm_setr_ps(1.0f, 1.0f, 2.0f, 2.0f);
+    int i = 0;
+    for (; i + 2 <= frames; i += 2) {
+        __m128 gain = _mm_add_ps(vfrom, _mm_mul_ps(vstep, index));
+        _mm_storeu_ps(samples + i*2, _mm_mul_ps(_mm_loadu_ps(samples + i*2), gain));
+        index = _mm_add_ps(index, two);
+    }
+    for (; i < frames; i++) {
+        float gain = from + step*(float)(i + 1);
+        samples[i*2] *= gain;
+        samples[i*2 + 1] *= gain;
+    }
+}
+
+static void MixInputsSse2(float *dst, const float *const *inputs, const float *gains, int inputCount, int count) {
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 sum = _mm_setzero_ps();
+        for (int k = 0; k < inputCount; k++) {
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(inputs[k] + i), _mm_set1_ps(gains[k])));
+        }
+        _mm_storeu_ps(dst + i, sum);
+    }
+    for (; i < count; i++) {
+        float sum = 0.0f;
+        for (int k = 0; k < inputCount; k++) sum = sum + inputs[k][i]*gains[k];
+        dst[i] = sum;
+    }
+}
+
+static void ClampSamplesSse2(float *samples, int count, float limit) {
+    const __m128 high = _mm_set1_ps(limit);
+    const __m128 low = _mm_set1_ps(-limit);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_ps(samples + i, _mm_min_ps(_mm_max_ps(_mm_loadu_ps(samples + i), low), high));
+    }
+    ClampSamplesScalar(samples + i, count - i, limit);
+}
+
+static void SoftClipSse2(float *samples, int count) {
+    const float range = 1.0f - DSP_SOFT_CLIP_KNEE;
+    const __m128 knee = _mm_set1_ps(DSP_SOFT_CLIP_KNEE);
+    const __m128 vrange = _mm_set1_ps(range);
+    const __m128 scale = _mm_set1_ps(1.0f/range);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 x = _mm_loadu_ps(samples + i);
+        __m128 a = _mm_andnot_ps(sign, x);
+        __m128 u = _mm_mul_ps(_mm_max_ps(_mm_sub_ps(a, knee), _mm_setzero_ps()), scale);
+        __m128 y = _mm_add_ps(_mm_min_ps(a, knee), _mm_mul_ps(vrange, _mm_div_ps(u, _mm_add_ps(one, u))));
+        _mm_storeu_ps(samples + i, _mm_or_ps(y, _mm_and_ps(sign, x)));
+    }
+    SoftClipScalar(samples + i, count - i);
+}
+
+static float DotProductSse2(const float *a, const float *b, int count) {
+    __m128 low = _mm_setzero_ps();
+    __m128 high = _mm_setzero_ps();
+    for (int i = 0; i < count; i += 8) {
+        low = _mm_add_ps(low, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        high = _mm_add_ps(high, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    float lanes[8];
+    _mm_storeu_ps(lanes, low);
+    _mm_storeu_ps(lanes + 4, high);
+    return ReduceLanes(lanes);
+}
+
+static void ButterfliesSse2(float *re, float *im, const float *twiddleRe, const float *twiddleIm, int half) {
+    int j = 0;
+    for (; j + 4 <= half; j += 4) {
+        __m128 ar = _mm_loadu_ps(re + j), ai = _mm_loadu_ps(im + j);
+        __m128 br = _mm_loadu_ps(re + j + half), bi = _mm_loadu_ps(im + j + half);
+        __m128 wr = _mm_loadu_ps(twiddleRe + j), wi = _mm_loadu_ps(twiddleIm + j);
+        __m128 tr = _mm_sub_ps(_mm_mul_ps(br, wr), _mm_mul_ps(bi, wi));
+        __m128 ti = _mm_add_ps(_mm_mul_ps(br, wi), _mm_mul_ps(bi, wr));
+        _mm_storeu_ps(re + j + half, _mm_sub_ps(ar, tr));
+        _mm_storeu_ps(im + j + half, _mm_sub_ps(ai, ti));
+        _mm_storeu_ps(re + j, _mm_add_ps(ar, tr));
+        _mm_storeu_ps(im + j, _mm_add_ps(ai, ti));
+    }
+    ButterflyTail(re, im, twiddleRe, twiddleIm, half, j);
+}
+
+#endif
+
+#if defined(DSP_AVX2)
+
+// AVX2, checked at runtime
+
+__attribute__((target("avx2")))
+static void FloatToInt16Avx2(int16_t *dst, const float *src, int count) {
+    const __m256 scale = _mm256_set1_ps(32768.0f);
+    const __m256 low = _mm256_set1_ps(-32768.0f);
+    const __m256 high = _mm256_set1_ps(32767.0f);
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256 a = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(src + i), scale), low), high);
+        __m256 b = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(src + i + 8), scale), low), high);
+        // packs works per 128-bit lane, so put the quadwords back in order
+        __m256i packed = _mm256_packs_epi32(_mm256_cvtps_epi32(a), _mm256_cvtps_epi32(b));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_permute4x64_epi64(packed, 0xD8));
+    }
+    FloatToInt16Sse2(dst + i, src + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void Int16ToFloatAvx2(float *dst, const int16_t *src, int count) {
+    const __m256 scale = _mm256_set1_ps(1.0f/32768.0f);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i x = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(src + i)));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale));
+    }
+    Int16ToFloatScalar(dst + i, src + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void GainRampAvx2(float *samples, int frames, int channels, float from, float to) {
+    if (channels != 2) {
+        GainRampScalar(samples, frames, channels, from, to);
+        return;
+    }
+
+    // Four stereo frames per vector
+    float step = (to - from)/frames;
+    const __m256 vstep = _mm256_set1_ps(step);
+    const __m256 vfrom = _mm256_set1_ps(from);
+    const __m256 four = _mm256_set1_ps(4.0f);
+    __m256 index = _mm256_setr_ps(1.0f, 1.0f, 2.0f, 2.0f, 3.0f, 3.0f, 4.0f, 4.0f);
+    int i = 0;
+    for (; i + 4 <= frames; i += 4) {
+        __m256 gain = _mm256_add_ps(vfrom, _mm256_mul_ps(vstep, index));
+        _mm256_storeu_ps(samples + i*2, _mm256_mul_ps(_mm256_loadu_ps(samples + i*2), gain));
+        index = _mm256_add_ps(index, four);
+    }
+    for (; i < frames; i++) {
+        float gain = from + step*(float)(i + 1);
+        samples[i*2] *= gain;
+        samples[i*2 + 1] *= gain;
+    }
+}
+
+__attribute__((target("avx2")))
+static void MixInputsAvx2(float *dst, const float *const *inputs, const float *gains, int inputCount, int count) {
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 sum = _mm256_setzero_ps();
+        for (int k = 0; k < inputCount; k++) {
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(inputs[k] + i), _mm256_set1_ps(gains[k])));
+        }
+        _mm256_storeu_ps(dst + i, sum);
+    }
+    const float *tails[DSP_MAX_MIX_INPUTS];
+    for (int k = 0; k < inputCount; k++) tails[k] = inputs[k] + i;
+    MixInputsSse2(dst + i, tails, gains, inputCount, count - i);
+}
+
+__attribute__((target("avx2")))
+static void ClampSamplesAvx2(float *samples, int count, float limit) {
+    const __m256 high = _mm256_set1_ps(limit);
+    const __m256 low = _mm256_set1_ps(-limit);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_ps(samples + i, _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(samples + i), low), high));
+    }
+    ClampSamplesSse2(samples + i, count - i, limit);
+}
+
+__attribute__((target("avx2")))
+static void SoftClipAvx2(float *samples, int count) {
+    const float range = 1.0f - DSP_SOFT_CLIP_KNEE;
+    const __m256 knee = _mm256_set1_ps(DSP_SOFT_CLIP_KNEE);
+    const __m256 vrange = _mm256_set1_ps(range);
+    const __m256 scale = _mm256_set1_ps(1.0f/range);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 x = _mm256_loadu_ps(samples + i);
+        __m256 a = _mm256_andnot_ps(sign, x);
+        __m256 u = _mm256_mul_ps(_mm256_max_ps(_mm256_sub_ps(a, knee), _mm256_setzero_ps()), scale);
+        __m256 y = _mm256_add_ps(_mm256_min_ps(a, knee), _mm256_mul_ps(vrange, _mm256_div_ps(u, _mm256_add_ps(one, u))));
+        _mm256_storeu_ps(samples + i, _mm256_or_ps(y, _mm256_and_ps(sign, x)));
+    }
+    SoftClipSse2(samples + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static float DotProductAvx2(const float *a, const float *b, int count) {
+    __m256 sum = _mm256_setzero_ps();
+    for (int i = 0; i < count; i += 8) {
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+    }
+    float lanes[8];
+    _mm256_storeu_ps(lanes, sum);
+    return ReduceLanes(lanes);
+}
+
+__attribute__((target("avx2")))
+static void ButterfliesAvx2(float *re, float *im, const float *twiddleRe, const float *twiddleIm, int half) {
+    int j = 0;
+    for (; j + 8 <= half; j += 8) {
+        __m256 ar = _mm256_loadu_ps(re + j), ai = _mm256_loadu_ps(im + j);
+        __m256 br = _mm256_loadu_ps(re + j + half), bi = _mm256_loadu_ps(im + j + half);
+        __m256 wr = _mm256_loadu_ps(twiddleRe + j), wi = _mm256_loadu_ps(twiddleIm + j);
+        __m256 tr = _mm256_sub_ps(_mm256_mul_ps(br, wr), _mm256_mul_ps(bi, wi));
+        __m256 ti = _mm256_add_ps(_mm256_mul_ps(br, wi), _mm256_mul_ps(bi, wr));
+        _mm256_storeu_ps(re + j + half, _mm256_sub_ps(ar, tr));
+        _mm256_storeu_ps(im + j + half, _mm256_sub_ps(ai, ti));
+        _mm256_storeu_ps(re + j, _mm256_add_ps(ar, tr));
+        _mm256_storeu_ps(im + j, _mm256_add_ps(ai, ti));
+    }
+    ButterflyTail(re, im, twiddleRe, twiddleIm, half, j);
+}
+
+#endif
+
+#if defined(DSP_NEON)
+
+static void FloatToInt16Neon(int16_t *dst, const float *src, int count) {
+    const float32x4_t scale = vdupq_n_f32(32768.0f);
+    const float32x4_t low = vdupq_n_f32(-32768.0f);
+    const float32x4_t high = vdupq_n_f32(32767.0f);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        float32x4_t a = vminq_f32(vmaxq_f32(vmulq_f32(vld1q_f32(src + i), scale), low), high);
+        float32x4_t b = vminq_f32(vmaxq_f32(vmulq_f32(vld1q_f32(src + i + 4), scale), low), high);
+        vst1q_s16(dst + i, vcombine_s16(vqmovn_s32(vcvtnq_s32_f32(a)), vqmovn_s32(vcvtnq_s32_f32(b))));
+    }
+    FloatToInt16Scalar(dst + i, src + i, count - i);
+}
+
+static void Int16ToFloatNeon(float *dst, const int16_t *src, int count) {
+    const float32x4_t scale = vdupq_n_f32(1.0f/32768.0f);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t x = vld1q_s16(src + i);
+        vst1q_f32(dst + i, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))), scale));
+        vst1q_f32(dst + i + 4, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))), scale));
+    }
+    Int16ToFloatScalar(dst + i, src + i, count - i);
+}
+
+static void GainRampNeon(float *samples, int frames, int channels, float from, float to) {
+    if (channels != 2) {
+        GainRampScalar(samples, frames, channels, from, to);
+        return;
+    }
+
+    float step = (to - from)/frames;
+    const float32x4_t vstep = vdupq_n_f32(step);
+    const float32x4_t vfrom = vdupq_n_f32(from);
+    const float32x4_t two = vdupq_n_f32(2.0f);
+    const float start[4] = { 1.0f, 1.0f, 2.0f, 2.0f };
+    float32x4_t index = vld1q_f32(start);
+    int i = 0;
+    for (; i + 2 <= frames; i += 2) {
+        float32x4_t gain = vaddq_f32(vfrom, vmulq_f32(vstep, index));
+        vst1q_f32(samples + i*2, vmulq_f32(vld1q_f32(samples + i*2), gain));
+        index = vaddq_f32(index, two);
+    }
+    for (; i < frames; i++) {
+        float gain = from + step*(float)(i + 1);
+        samples[i*2] *= gain;
+        samples[i*2 + 1] *= gain;
+    }
+}
+
+static void MixInputsNeon(float *dst, const float *const *inputs, const float *gains, int inputCount, int count) {
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        float32x4_t sum = vdupq_n_f32(0.0f);
+        for (int k = 0; k < inputCount; k++) {
+            sum = vaddq_f32(sum, vmulq_f32(vld1q_f32(inputs[k] + i), vdupq_n_f32(gains[k])));
+        }
+        vst1q_f32(dst + i, sum);
+    }
+    for (; i < count; i++) {
+        float sum = 0.0f;
+        for (int k = 0; k < inputCount; k++) sum = sum + inputs[k][i]*gains[k];
+        dst[i] = sum;
+    }
+}
+
+static void ClampSamplesNeon(float *samples, int count, float limit) {
+    const float32x4_t high = vdupq_n_f32(limit);
+    const float32x4_t low = vdupq_n_f32(-limit);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        vst1q_f32(samples + i, vminq_f32(vmaxq_f32(vld1q_f32(samples + i), low), high));
+    }
+    ClampSamplesScalar(samples + i, count - i, limit);
+}
+
+static void SoftClipNeon(float *samples, int count) {
+    const float range = 1.0f - DSP_SOFT_CLIP_KNEE;
+    const float32x4_t knee = vdupq_n_f32(DSP_SOFT_CLIP_KNEE);
+    const float32x4_t vrange = vdupq_n_f32(range);
+    const float32x4_t scale = vdupq_n_f32(1.0f/range);
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    const uint32x4_t sign = vdupq_n_u32(0x80000000u);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        float32x4_t x = vld1q_f32(samples + i);
+        float32x4_t a = vabsq_f32(x);
+        float32x4_t u = vmulq_f32(vmaxq_f32(vsubq_f32(a, knee), vdupq_n_f32(0.0f)), scale);
+        float32x4_t y = vaddq_f32(vminq_f32(a, knee), vmulq_f32(vrange, vdivq_f32(u, vaddq_f32(one, u))));
+        uint32x4_t bits = vorrq_u32(vreinterpretq_u32_f32(y), vandq_u32(sign, vreinterpretq_u32_f32(x)));
+        vst1q_f32(samples + i, vreinterpretq_f32_u32(bits));
+    }
+    SoftClipScalar(samples + i, count - i);
+}
+
+static float DotProductNeon(const float *a, const float *b, int count) {
+    float32x4_t low = vdupq_n_f32(0.0f);
+    float32x4_t high = vdupq_n_f32(0.0f);
+    for (int i = 0; i < count; i += 8) {
+        low = vaddq_f32(low, vmulq_f32(vld1q_f32(a + i), vld1q_f32(b + i)));
+        high = vaddq_f32(high, vmulq_f32(vld1q_f32(a + i + 4), vld1q_f32(b + i + 4)));
+    }
+    float lanes[8];
+    vst1q_f32(lanes, low);
+    vst1q_f32(lanes + 4, high);
+    return ReduceLanes(lanes);
+}
+
+static void ButterfliesNeon(float *re, float *im, const float *twiddleRe, const float *twiddleIm, int half) {
+    int j = 0;
+    for (; j + 4 <= half; j += 4) {
+        float32x4_t ar = vld1q_f32(re + j), ai = vld1q_f32(im + j);
+        float32x4_t br = vld1q_f32(re + j + half), bi = vld1q_f32(im + j + half);
+        float32x4_t wr = vld1q_f32(twiddleRe + j), wi = vld1q_f32(twiddleIm + j);
+        float32x4_t tr = vsubq_f32(vmulq_f32(br, wr), vmulq_f32(bi, wi));
+        float32x4_t ti = vaddq_f32(vmulq_f32(br, wi), vmulq_f32(bi, wr));
+        vst1q_f32(re + j + half, vsubq_f32(ar, tr));
+        vst1q_f32(im + j + half, vsubq_f32(ai, ti));
+        vst1q_f32(re + j, vaddq_f32(ar, tr));
+        vst1q_f32(im + j, vaddq_f32(ai, ti));
+    }
+    ButterflyTail(re, im, twiddleRe, twiddleIm, half, j);
+}
+
+#endif
+
+static const DspKernels scalarKernels = {
+    "scalar", FloatToInt16Scalar, Int16ToFloatScalar, GainRampScalar, MixInputsScalar, ClampSamplesScalar, SoftClipScalar, DotProductScalar,
+    ButterfliesScalar
+};
+
+#if defined(DSP_X86)
+static const DspKernels sse2Kernels = {
+    "sse2", FloatToInt16Sse2, Int16ToFloatSse2, GainRampSse2, MixInputsSse2, ClampSamplesSse2, SoftClipSse2, DotProductSse2,
+    ButterfliesSse2
+};
+#endif
+
+#if defined(DSP_AVX2)
+static const DspKernels avx2Kernels = {
+    "avx2", FloatToInt16Avx2, Int16ToFloatAvx2, GainRampAvx2, MixInputsAvx2, ClampSamplesAvx2, SoftClipAvx2, DotProductAvx2,
+    ButterfliesAvx2
+};
+#endif
+
+#if defined(DSP_NEON)
+static const DspKernels neonKernels = {
+    "neon", FloatToInt16Neon, Int16ToFloatNeon, GainRampNeon, MixInputsNeon, ClampSamplesNeon, SoftClipNeon, DotProductNeon,
+    ButterfliesNeon
+};
+#endif
+
+// Runs a candidate against the scalar reference on an awkward length, so vector
+// bodies and scalar tails are both exercised
+static bool MatchesScalarKernels(const DspKernels *kernels) {
+    enum { COUNT = 1037 };
+    static float input[2][COUNT], expected[COUNT], actual[COUNT];
+    static int16_t pcm[COUNT], expectedPcm[COUNT], actualPcm[COUNT];
+
+    unsigned int seed = 12345;
+    for (int k = 0; k < 2; k++) {
+        for (int i = 0; i < COUNT; i++) {
+            seed = seed*1103515245u + 12345u;
+            input[k][i] = ((seed >> 8) & 0xFFFF)/21845.0f - 1.5f;   // -1.5..1.5
+        }
+    }
+    for (int i = 0; i < COUNT; i++) pcm[i] = (int16_t)(input[0][i]*20000.0f);
+
+    scalarKernels.FloatToInt16(expectedPcm, input[0], COUNT);
+    kernels->FloatToInt16(actualPcm, input[0], COUNT);
+    if (memcmp(expectedPcm, actualPcm, sizeof(expectedPcm)) != 0) return false;
+
+    scalarKernels.Int16ToFloat(expected, pcm, COUNT);
+    kernels->Int16ToFloat(actual, pcm, COUNT);
+    if (memcmp(expected, actual, sizeof(expected)) != 0) return false;
+
+    memcpy(expected, input[0], sizeof(expected));
+    memcpy(actual, input[0], sizeof(actual));
+    scalarKernels.GainRamp(expected, COUNT/2, 2, 0.25f, 0.9f);
+    kernels->GainRamp(actual, COUNT/2, 2, 0.25f, 0.9f);
+    if (memcmp(expected, actual, sizeof(expected)) != 0) return false;
+
+    const float *inputs[2] = { input[0], input[1] };
+    const float gains[2] = { 0.7f, 0.45f };
+    scalarKernels.MixInputs(expected, inputs, gains, 2, COUNT);
+    kernels->MixInputs(actual, inputs, gains, 2, COUNT);
+    if (memcmp(expected, actual, sizeof(expected)) != 0) return false;
+
+    memcpy(expected, input[0], sizeof(expected));
+    memcpy(actual, input[0], sizeof(actual));
+    scalarKernels.ClampSamples(expected, COUNT, 1.0f);
+    kernels->ClampSamples(actual, COUNT, 1.0f);
+    if (memcmp(expected, actual, sizeof(expected)) != 0) return false;
+
+    memcpy(expected, input[0], sizeof(expected));
+    memcpy(actual, input[0], sizeof(actual));
+    scalarKernels.SoftClip(expected, COUNT);
+    kernels->SoftClip(actual, COUNT);
+    if (memcmp(expected, actual, sizeof(expected)) != 0) return false;
+
+    float expectedDot = scalarKernels.DotProduct(input[0], input[1], COUNT & ~7);
+    float actualDot = kernels->DotProduct(input[0], input[1], COUNT & ~7);
+    if (memcmp(&expectedDot, &actualDot, sizeof(float)) != 0) return false;
+
+    // Real and imaginary halves from the two inputs, twiddles from their tails
+    static float expectedIm[COUNT], actualIm[COUNT];
+    enum { HALF = COUNT/4 };
+    memcpy(expected, input[0], sizeof(expected));
+    memcpy(actual, input[0], sizeof(actual));
+    memcpy(expectedIm, input[1], sizeof(expectedIm));
+    memcpy(actualIm, input[1], sizeof(actualIm));
+    scalarKernels.Butterflies(expected, expectedIm, input[0] + 2*HALF, input[1] + 2*HALF, HALF);
+    kernels->Butterflies(actual, actualIm, input[0] + 2*HALF, input[1] + 2*HALF, HALF);
+    return memcmp(expected, actual, sizeof(expected)) == 0 && memcmp(expectedIm, actualIm, sizeof(expectedIm)) == 0;
+}
+
+void InitDspKernels(void) {
+    const DspKernels *candidates[4];
+    int candidateCount = 0;
+
+#if defined(DSP_X86)
+#if defined(DSP_AVX2)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) candidates[candidateCount++] = &avx2Kernels;
+#endif
+    candidates[candidateCount++] = &sse2Kernels;
+#elif defined(DSP_NEON)
+    candidates[candidateCount++] = &neonKernels;
+#endif
+    candidates[candidateCount++] = &scalarKernels;
+
+    const char *forced = getenv("ULTRAPLAYER_DSP");
+    dsp = scalarKernels;
+    for (int i = 0; i < candidateCount; i++) {
+        if (forced != NULL && strcmp(forced, candidates[i]->name) != 0) continue;
+        if (!MatchesScalarKernels(candidates[i])) {
+            printf("Warning: %s kernels do not match the scalar reference, skipping\n", candidates[i]->name);
+            continue;
+        }
+        dsp = *candidates[i];
+        break;
+    }
+    printf("Using %s audio kernels\n", dsp.name);
+}
+
+// Resampler
+
+static int GreatestCommonDivisor(int a, int b) {
+    while (b != 0) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Zeroth order modified Bessel function, for the Kaiser window
+static double BesselI0(double x) {
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 32; k++) {
+        term *= (x/(2.0*k))*(x/(2.0*k));
+        sum += term;
+        if (term < sum*1e-12) break;
+    }
+    return sum;
+}
+
+bool InitDspResampler(DspResampler *resampler, int inRate, int outRate) {
+    memset(resampler, 0, sizeof(*resampler));
+    if (inRate <= 0 || outRate <= 0) return false;
+
+    int divisor = GreatestCommonDivisor(inRate, outRate);
+    resampler->inRate = inRate;
+    resampler->outRate = outRate;
+    resampler->up = outRate/divisor;
+    resampler->down = inRate/divisor;
+    resampler->phases = resampler->up < DSP_RESAMPLER_MAX_PHASES ? resampler->up : DSP_RESAMPLER_MAX_PHASES;
+    resampler->coefficients = (float *)malloc(sizeof(float)*resampler->phases*DSP_RESAMPLER_TAPS);
+    if (resampler->coefficients == NULL) return false;
+
+    // Cut off a little below the lower Nyquist frequency, so downsampling does not alias
+    const double beta = 8.0;
+    double cutoff = 0.45*(outRate < inRate ? (double)outRate/inRate : 1.0);
+    double window = BesselI0(beta);
+    for (int p = 0; p < resampler->phases; p++) {
+        float *row = resampler->coefficients + p*DSP_RESAMPLER_TAPS;
+        double fraction = (double)p/resampler->phases;
+        double sum = 0.0;
+        double taps[DSP_RESAMPLER_TAPS];
+        for (int k = 0; k < DSP_RESAMPLER_TAPS; k++) {
+            double x = (k - DSP_RESAMPLER_TAPS/2 + 1) - fraction;
+            double r = x/(DSP_RESAMPLER_TAPS/2);
+            double w = (r*r < 1.0) ? BesselI0(beta*sqrt(1.0 - r*r))/window : 0.0;
+            double sinc = (x == 0.0) ? 1.0 : sin(2.0*DSP_PI*cutoff*x)/(2.0*DSP_PI*cutoff*x);
+            taps[k] = sinc*w;
+            sum += taps[k];
+        }
+        // Unity gain at DC for every phase
+        for (int k = 0; k < DSP_RESAMPLER_TAPS; k++) row[k] = (float)(taps[k]/sum);
+    }
+    return true;
+}
+
+void FreeDspResampler(DspResampler *resampler) {
+    free(resampler->coefficients);
+    resampler->coefficients = NULL;
+}
+
+int GetResampledFrames(const DspResampler *resampler, int inFrames) {
+    return (int)(((long long)inFrames*resampler->up + resampler->down - 1)/resampler->down);
+}
+
+void ResampleChannel(const DspResampler *resampler, float *out, const float *in, int inFrames) {
+    int outFrames = GetResampledFrames(resampler, inFrames);
+    for (int n = 0; n < outFrames; n++) {
+        long long position = (long long)n*resampler->down;
+        long long index = position/resampler->up;
+        int phase = (int)(position % resampler->up);
+        if (resampler->phases != resampler->up) {
+            phase = (int)(((long long)phase*resampler->phases + resampler->up/2)/resampler->up);
+            if (phase == resampler->phases) {
+                phase = 0;
+                index++;
+            }
+        }
+        const float *window = in + index - DSP_RESAMPLER_TAPS/2 + 1;
+        out[n] = dsp.DotProduct(window, resampler->coefficients + phase*DSP_RESAMPLER_TAPS, DSP_RESAMPLER_TAPS);
+    }
+}
+
+// FFT
+
+bool InitDspFft(DspFft *fft, int size) {
+    *fft = (DspFft){ 0 };
+    if (size < 2 || size > DSP_FFT_MAX_SIZE || (size & (size - 1)) != 0) return false;
+
+    fft->size = size;
+    fft->reverse = (int *)malloc(sizeof(int)*size);
+    fft->twiddleRe = (float *)malloc(sizeof(float)*size);
+    fft->twiddleIm = (float *)malloc(sizeof(float)*size);
+    if (fft->reverse == NULL || fft->twiddleRe == NULL || fft->twiddleIm == NULL) {
+        FreeDspFft(fft);
+        return false;
+    }
+
+    int bits = 0;
+    while ((1 << bits) < size) bits++;
+    for (int i = 0; i < size; i++) {
+        int r = 0;
+        for (int b = 0; b < bits; b++) r |= ((i >> b) & 1) << (bits - 1 - b);
+        fft->reverse[i] = r;
+    }
+
+    // Each stage gets its own contiguous table so the butterflies load it linearly
+    for (int half = 1; half < size; half *= 2) {
+        for (int j = 0; j < half; j++) {
+            double angle = -DSP_PI*j/half;
+            fft->twiddleRe[half - 1 + j] = (float)cos(angle);
+            fft->twiddleIm[half - 1 + j] = (float)sin(angle);
+        }
+    }
+    return true;
+}
+
+void FreeDspFft(DspFft *fft) {
+    free(fft->reverse);
+    free(fft->twiddleRe);
+    free(fft->twiddleIm);
+    *fft = (DspFft){ 0 };
+}
+
+void RunDspFft(const DspFft *fft, float *re, float *im) {
+    for (int i = 0; i < fft->size; i++) {
+        int r = fft->reverse[i];
+        if (r <= i) continue;
+        float t = re[i]; re[i] = re[r]; re[r] = t;
+        t = im[i]; im[i] = im[r]; im[r] = t;
+    }
+    for (int half = 1; half < fft->size; half *= 2) {
+        for (int start = 0; start < fft->size; start += 2*half) {
+            dsp.Butterflies(re + start, im + start, fft->twiddleRe + half - 1, fft->twiddleIm + half - 1, half);
+        }
+    }
+}
+
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT DEFAULT
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
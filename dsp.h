@@ -0,0 +1,86 @@
+#ifndef DSP_H
+#define DSP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Sample kernels for the audio path. Every kernel has a scalar reference and
+// SSE2/AVX2/NEON versions picked at startup; the vector versions do the same
+// operations in the same order, so their output is bit-identical to the scalar one.
+typedef struct DspKernels {
+    const char *name;
+
+    // float <-> int16, full scale is 32768 and conversion rounds to nearest
+    void (*FloatToInt16)(int16_t *dst, const float *src, int count);
+    void (*Int16ToFloat)(float *dst, const int16_t *src, int count);
+
+    // Multiplies frame i by from + (to - from)*(i + 1)/frames
+    void (*GainRamp)(float *samples, int frames, int channels, float from, float to);
+
+    // dst = sum of inputs[k]*gains[k], summed in input order, for up to
+    // DSP_MAX_MIX_INPUTS inputs; dst may be one of the inputs
+    void (*MixInputs)(float *dst, const float *const *inputs, const float *gains, int inputCount, int count);
+
+    // Limits every sample to [-limit, limit]
+    void (*ClampSamples)(float *samples, int count, float limit);
+
+    // Identity up to DSP_SOFT_CLIP_KNEE, then bends smoothly towards +-1
+    void (*SoftClip)(float *samples, int count);
+
+    // Sum of a[i]*b[i]; count must be a multiple of 8, accumulated in 8 lanes
+    float (*DotProduct)(const float *a, const float *b, int count);
+
+    // Radix-2 butterflies over one block of split complex data: for j < half,
+    // t = x[j + half]*w[j], x[j + half] = x[j] - t, x[j] = x[j] + t
+    void (*Butterflies)(float *re, float *im, const float *twiddleRe, const float *twiddleIm, int half);
+} DspKernels;
+
+#define DSP_SOFT_CLIP_KNEE 0.8f
+#define DSP_MAX_MIX_INPUTS 64
+
+// raylib's PI is a float, filter design wants the double
+#define DSP_PI 3.14159265358979323846
+
+// Polyphase windowed-sinc resampler. The ratio is reduced to up/down; ratios
+// with more than DSP_RESAMPLER_MAX_PHASES phases snap to the nearest phase
+#define DSP_RESAMPLER_TAPS 64
+#define DSP_RESAMPLER_MAX_PHASES 1024
+
+typedef struct DspResampler {
+    int inRate;
+    int outRate;
+    int up;
+    int down;
+    int phases;
+    float *coefficients;        // phases rows of DSP_RESAMPLER_TAPS
+} DspResampler;
+
+extern DspKernels dsp;
+
+// Picks the widest supported kernels; ULTRAPLAYER_DSP=scalar|sse2|avx2|neon forces one
+void InitDspKernels(void);
+
+bool InitDspResampler(DspResampler *resampler, int inRate, int outRate);
+void FreeDspResampler(DspResampler *resampler);
+int GetResampledFrames(const DspResampler *resampler, int inFrames);
+
+// Resamples one channel into GetResampledFrames(inFrames) samples. The filter
+// reads past both ends of in, so the caller keeps DSP_RESAMPLER_TAPS zeroed
+// samples before and after it
+void ResampleChannel(const DspResampler *resampler, float *out, const float *in, int inFrames);
+
+// In-place complex FFT on split real/imaginary arrays, size a power of two
+#define DSP_FFT_MAX_SIZE 65536
+
+typedef struct DspFft {
+    int size;
+    int *reverse;               // bit-reversed index of each input
+    float *twiddleRe;           // per stage, the stage with half h starts at h - 1
+    float *twiddleIm;
+} DspFft;
+
+bool InitDspFft(DspFft *fft, int size);
+void FreeDspFft(DspFft *fft);
+void RunDspFft(const DspFft *fft, float *re, float *im);
+
+#endif
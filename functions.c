@@ -1,4 +1,5 @@
 #include "functions.h"
+#include "pack.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -21,7 +22,127 @@ char *LoadFileTextCustom(const char *fileName) {
     return text;
 }
 
-bool ParseJSONData(const char *jsonFileName, Level levels[], int *levelCount) {
+// From the stem's converted copy if it has one, else from the pack, the preload or disk
+static Music LoadSegmentMusic(Stem *stem, int bufferFrames) {
+    const char *path = stem->path;
+    int size;
+    stem->fileBacked = (stem->resampledFile != NULL || FindAssetInMemory(path, &size) == NULL);
+
+    // The buffer size default is global in raylib, so set it only around this load
+    if (bufferFrames > 0) SetAudioStreamBufferSizeDefault(bufferFrames);
+    Music music = (stem->resampledFile != NULL) ? LoadMusicStream(stem->resampledFile) : LoadAssetMusic(path);
+    if (bufferFrames > 0) SetAudioStreamBufferSizeDefault(0);
+
+    // raylib stops a non-looping stream as soon as its last frames are decoded, cutting
+    // off what is still queued; the stream monitor ends it on the exact frame instead
+    if (music.ctxData == NULL) {
+        printf("Failed to load music: %s\n", path);
+    } else {
+        music.looping = true;
+    }
+    return music;
+}
+
+static void ParseBufferSize(cJSON *item, int *bufferFrames, bool *adaptive) {
+    // "buffer-size" is either a frame count or "adaptive"
+    if (cJSON_IsNumber(item)) {
+        *bufferFrames = ClampBufferFrames(item->valueint);
+        *adaptive = false;
+    } else if (cJSON_IsString(item) && strcmp(item->valuestring, "adaptive") == 0) {
+        *adaptive = true;
+    } else if (item != NULL) {
+        printf("Warning: Ignoring invalid buffer-size\n");
+    }
+}
+
+static void AddStem(Segment *seg, const char *name, const char *baseFolder, const char *folder, const char *file,
+                    float gain, float intensity) {
+    Stem *stem = &seg->stems[seg->stemCount++];
+    snprintf(stem->name, sizeof(stem->name), "%s", name);
+    snprintf(stem->path, sizeof(stem->path), "%s/%s/%s", baseFolder, folder, file);
+    stem->curve = (StemCurve){ gain, intensity, intensity, intensity };
+    stem->normalization = 1.0f;
+}
+
+static bool ParseSegmentStems(cJSON *segmentEntry, Segment *seg, const char *baseFolder, const char *folder) {
+    seg->stemCount = 0;
+
+    cJSON *stemsItem = cJSON_GetObjectItemCaseSensitive(segmentEntry, "stems");
+    if (cJSON_IsArray(stemsItem)) {
+        // "stems": [ { "name": ..., "file": ..., "gain": 1.0, "intensity": 0.0 }, ... ]
+        int count = cJSON_GetArraySize(stemsItem);
+        cJSON *stemEntry = NULL;
+        cJSON_ArrayForEach(stemEntry, stemsItem) {
+            if (seg->stemCount >= MAX_STEMS) break;
+
+            cJSON *fileItem = cJSON_GetObjectItemCaseSensitive(stemEntry, "file");
+            cJSON *stemNameItem = cJSON_GetObjectItemCaseSensitive(stemEntry, "name");
+            cJSON *gainItem = cJSON_GetObjectItemCaseSensitive(stemEntry, "gain");
+            cJSON *intensityItem = cJSON_GetObjectItemCaseSensitive(stemEntry, "intensity");
+            if (!cJSON_IsString(fileItem)) continue;
+
+            // Without an explicit intensity, stems are spread evenly in declaration order
+            float intensity = (count > 1) ? seg->stemCount/(float)(count - 1) : 0.0f;
+            AddStem(seg, cJSON_IsString(stemNameItem) ? stemNameItem->valuestring : fileItem->valuestring,
+                    baseFolder, folder, fileItem->valuestring,
+                    cJSON_IsNumber(gainItem) ? (float)gainItem->valuedouble : 1.0f,
+                    cJSON_IsNumber(intensityItem) ? (float)intensityItem->valuedouble : intensity);
+        }
+    } else {
+        // The original layout: a free loop and an optional combat loop
+        cJSON *freeMusicItem = cJSON_GetObjectItemCaseSensitive(segmentEntry, "free");
+        cJSON *combatMusicItem = cJSON_GetObjectItemCaseSensitive(segmentEntry, "combat");
+        if (cJSON_IsString(freeMusicItem)) AddStem(seg, "free", baseFolder, folder, freeMusicItem->valuestring, 1.0f, 0.0f);
+        if (seg->stemCount > 0 && cJSON_IsString(combatMusicItem)) {
+            AddStem(seg, "combat", baseFolder, folder, combatMusicItem->valuestring, 1.0f, 1.0f);
+        }
+    }
+
+    // Each stem fades out towards the peaks of its nearest neighbours
+    for (int i = 0; i < seg->stemCount; i++) {
+        StemCurve *curve = &seg->stems[i].curve;
+        for (int j = 0; j < seg->stemCount; j++) {
+            float other = seg->stems[j].curve.peak;
+            if (other < curve->peak && (curve->low == curve->peak || other > curve->low)) curve->low = other;
+            if (other > curve->peak && (curve->high == curve->peak || other < curve->high)) curve->high = other;
+        }
+    }
+
+    seg->hasCombat = seg->stemCount > 1;
+    return seg->stemCount > 0;
+}
+
+// A key the map does not have gets a group named after it
+static int FindLayer(AppState *state, const char *key, bool add) {
+    for (int i = 0; i < state->layerCount; i++) {
+        if (strcmp(state->layers[i].key, key) == 0) return i;
+    }
+    if (!add || state->layerCount >= MAX_LAYERS) return -1;
+
+    LayerGroup *group = &state->layers[state->layerCount];
+    snprintf(group->key, sizeof(group->key), "%s", key);
+    snprintf(group->name, sizeof(group->name), "%s", key);
+    group->collapsed = false;
+    group->levels = NULL;
+    group->levelCount = group->levelCapacity = 0;
+    return state->layerCount++;
+}
+
+static bool AddLayerLevel(LayerGroup *group, int level) {
+    if (group->levelCount == group->levelCapacity) {
+        int capacity = group->levelCapacity ? group->levelCapacity*2 : 16;
+        int *levels = (int *)realloc(group->levels, sizeof(int)*capacity);
+        if (levels == NULL) return false;
+        group->levels = levels;
+        group->levelCapacity = capacity;
+    }
+    group->levels[group->levelCount++] = level;
+    return true;
+}
+
+bool ParseJSONData(const char *jsonFileName, AppState *state) {
+    int *levelCount = &state->levelCount;
+
 char *jsonText = LoadFileTextCustom(jsonFileName);
     if (jsonText == NULL)
     {
@@ -46,7 +167,74 @@ char *jsonText = LoadFileTextCustom(jsonFileName);
         return false;
     }
     const char *baseFolder = baseFolderItem->valuestring;
+
+    // Optional: grow a segment's stream buffers whenever it underruns
+    cJSON *autoGrowItem = cJSON_GetObjectItemCaseSensitive(jsonRoot, "auto-grow-buffers");
+    state->autoGrowBuffers = cJSON_IsTrue(autoGrowItem);
+
+    // Optional: default stream buffer size for every segment
+    ParseBufferSize(cJSON_GetObjectItemCaseSensitive(jsonRoot, "buffer-size"),
+                    &state->bufferFrames, &state->adaptiveBuffers);
+
+    // Optional: path of the local control socket
+    cJSON *controlSocketItem = cJSON_GetObjectItemCaseSensitive(jsonRoot, "control-socket");
+    if (cJSON_IsString(controlSocketItem)) {
+        strncpy(state->controlSocketPath, controlSocketItem->valuestring, sizeof(state->controlSocketPath) - 1);
+    }
+
+    // Optional: loudness every track is normalized to, in LUFS, or false to play files as they are
+    cJSON *loudnessItem = cJSON_GetObjectItemCaseSensitive(jsonRoot, "loudness-target");
+    state->normalizeLoudness = !cJSON_IsFalse(loudnessItem);
+    state->loudnessTarget = cJSON_IsNumber(loudnessItem) ? (float)loudnessItem->valuedouble : DEFAULT_LOUDNESS_TARGET;
+
+    // Optional: seconds the outgoing and incoming segments overlap when switching
+    cJSON *crossfadeItem = cJSON_GetObjectItemCaseSensitive(jsonRoot, "crossfade");
+    state->crossfade = cJSON_IsNumber(crossfadeItem) ? fmaxf((float)crossfadeItem->valuedouble, 0.0f) : 0.0f;
+
+    // Optional: GPU memory thumbnails may use before the least recently drawn are evicted
+    cJSON *thumbnailBudgetItem = cJSON_GetObjectItemCaseSensitive(jsonRoot, "thumbnail-budget-mb");
+    double thumbnailBudget = cJSON_IsNumber(thumbnailBudgetItem) ? thumbnailBudgetItem->valuedouble : THUMBNAIL_DEFAULT_BUDGET_MB;
+    state->thumbnailBudget = (size_t)(fmax(thumbnailBudget, 1.0)*1024*1024);
+
+    // Optional: streams kept open for segments that are not playing, see decoders.h
+    cJSON *decoderFilesItem = cJSON_GetObjectItemCaseSensitive(jsonRoot, "decoder-cache-files");
+    state->decoderCacheFiles = cJSON_IsNumber(decoderFilesItem) ? decoderFilesItem->valueint : DECODER_CACHE_DEFAULT_FILES;
+    if (state->decoderCacheFiles < 0) state->decoderCacheFiles = 0;
+    cJSON *decoderBudgetItem = cJSON_GetObjectItemCaseSensitive(jsonRoot, "decoder-cache-mb");
+    double decoderBudget = cJSON_IsNumber(decoderBudgetItem) ? decoderBudgetItem->valuedouble : DECODER_CACHE_DEFAULT_MB;
+    state->decoderCacheBudget = (size_t)(fmax(decoderBudget, 0.0)*1024*1024);
+    cJSON *maxOpenFilesItem = cJSON_GetObjectItemCaseSensitive(jsonRoot, "max-open-files");
+    state->maxOpenFiles = cJSON_IsNumber(maxOpenFilesItem) ? maxOpenFilesItem->valueint : 0;
+
+    // Optional: pack built by packtool; files in it are read from it instead of the base folder
+    cJSON *packItem = cJSON_GetObjectItemCaseSensitive(jsonRoot, "pack");
+    if (cJSON_IsString(packItem)) snprintf(state->packPath, sizeof(state->packPath), "%s", packItem->valuestring);
+
+    // Optional: read the audio into memory at startup, see preload.h
+    cJSON *preloadBudgetItem = cJSON_GetObjectItemCaseSensitive(jsonRoot, "preload-budget-mb");
+    double preloadBudget = cJSON_IsNumber(preloadBudgetItem) ? preloadBudgetItem->valuedouble : PRELOAD_DEFAULT_BUDGET_MB;
+    state->preloadBudget = (size_t)(fmax(preloadBudget, 0.0)*1024*1024);
+
+    // Optional: show the spectrum panel from the start
+    state->visualizer = cJSON_IsTrue(cJSON_GetObjectItemCaseSensitive(jsonRoot, "visualizer"));
+
+    // Optional: name of the shared-memory intensity channel
+    cJSON *sharedMemoryItem = cJSON_GetObjectItemCaseSensitive(jsonRoot, "shared-memory");
+    if (cJSON_IsString(sharedMemoryItem)) {
+        strncpy(state->sharedMemoryName, sharedMemoryItem->valuestring, sizeof(state->sharedMemoryName) - 1);
+    }
     
+    // Optional: layer groups, keyed the way levels refer to them
+    cJSON *layersObj = cJSON_GetObjectItemCaseSensitive(jsonRoot, "layers");
+    state->layerCount = 0;
+    state->showLayerHeaders = cJSON_IsObject(layersObj);
+    cJSON *layerEntry = NULL;
+    cJSON_ArrayForEach(layerEntry, layersObj) {
+        if (!cJSON_IsString(layerEntry) || layerEntry->string == NULL) continue;
+        int layer = FindLayer(state, layerEntry->string, true);
+        if (layer >= 0) snprintf(state->layers[layer].name, sizeof(state->layers[layer].name), "%s", layerEntry->valuestring);
+    }
+
     // Get the levels object (an object with level keys)
     cJSON *levelsObj = cJSON_GetObjectItemCaseSensitive(jsonRoot, "levels");
     if (!levelsObj)
@@ -56,11 +244,21 @@ char *jsonText = LoadFileTextCustom(jsonFileName);
         return false;
     }
     
+    // Sized for every entry up front, so Level and Segment pointers stay valid
+    int entryCount = cJSON_GetArraySize(levelsObj);
+    state->levels = (Level *)calloc(entryCount > 0 ? entryCount : 1, sizeof(Level));
+    state->searchSegment = (int *)calloc(entryCount > 0 ? entryCount : 1, sizeof(int));
+    if (state->levels == NULL || state->searchSegment == NULL) {
+        printf("Error: Could not allocate %d levels\n", entryCount);
+        cJSON_Delete(jsonRoot);
+        return false;
+    }
+    Level *levels = state->levels;
+
     *levelCount = 0;
     cJSON *levelEntry = NULL;
     cJSON_ArrayForEach(levelEntry, levelsObj)
     {
-        if (*levelCount >= MAX_LEVELS) break;
         
         // Level name
         const char *levelKey = levelEntry->string;
@@ -78,19 +276,17 @@ char *jsonText = LoadFileTextCustom(jsonFileName);
             continue;
         }
 
-        // Load thumbnail
+        // Thumbnail is loaded in the background
         snprintf(levels[*levelCount].thumbnailPath, sizeof(levels[*levelCount].thumbnailPath),
                  "%s/%s/%s", baseFolder, folderItem->valuestring, thumbItem->valuestring);
-        Image img = LoadImage(levels[*levelCount].thumbnailPath);
-        if (img.data != NULL)
-        {
-            levels[*levelCount].thumbnail = LoadTextureFromImage(img);
-            UnloadImage(img);
-        }
         
         // Initialize segments
         levels[*levelCount].segmentCount = 0;
         levels[*levelCount].currentSegment = 0;
+
+        // Optional: crossfade into this level's segments, overriding the global one
+        cJSON *levelCrossfadeItem = cJSON_GetObjectItemCaseSensitive(levelEntry, "crossfade");
+        levels[*levelCount].crossfade = cJSON_IsNumber(levelCrossfadeItem) ? fmaxf((float)levelCrossfadeItem->valuedouble, 0.0f) : -1.0f;
         
         // Parse segments
         cJSON *segmentEntry = NULL;
@@ -98,40 +294,63 @@ char *jsonText = LoadFileTextCustom(jsonFileName);
             if (levels[*levelCount].segmentCount >= MAX_SEGMENTS) break;
             
             cJSON *nameItem = cJSON_GetObjectItemCaseSensitive(segmentEntry, "name");
-            cJSON *freeMusicItem = cJSON_GetObjectItemCaseSensitive(segmentEntry, "free");
-            cJSON *combatMusicItem = cJSON_GetObjectItemCaseSensitive(segmentEntry, "combat");
             
-            if (!nameItem || !freeMusicItem) continue;
+            if (!cJSON_IsString(nameItem)) continue;
             
             int segIdx = levels[*levelCount].segmentCount;
             Segment *seg = &levels[*levelCount].segments[segIdx];
             
+            if (!ParseSegmentStems(segmentEntry, seg, baseFolder, folderItem->valuestring)) continue;
             strncpy(seg->name, nameItem->valuestring, sizeof(seg->name) - 1);
-            
-            char musicPath[512];
-            snprintf(musicPath, sizeof(musicPath), "%s/%s/%s",
-                     baseFolder, folderItem->valuestring, freeMusicItem->valuestring);
-            seg->free = LoadMusicStream(musicPath);
-            if (seg->free.ctxData == NULL) {
-                printf("Failed to load music: %s\n", musicPath);
-            } else {
-                seg->free.looping = false;
-            }
-            if (cJSON_IsString(combatMusicItem)) {
-                snprintf(musicPath, sizeof(musicPath), "%s/%s/%s",
-                        baseFolder, folderItem->valuestring, combatMusicItem->valuestring);
-                seg->combat = LoadMusicStream(musicPath);
-                if (seg->combat.ctxData != NULL) {
-                    seg->combat.looping = false;
-                }
-                seg->hasCombat = true;
-            }
-            
+
+            seg->bufferFrames = state->bufferFrames;
+            seg->adaptiveBuffer = state->adaptiveBuffers;
+            ParseBufferSize(cJSON_GetObjectItemCaseSensitive(segmentEntry, "buffer-size"),
+                            &seg->bufferFrames, &seg->adaptiveBuffer);
+            if (seg->adaptiveBuffer) seg->bufferFrames = PickAdaptiveBufferFrames();
+
+            // Optional tempo: switches and combat changes wait for the next bar (or beat)
+            cJSON *bpmItem = cJSON_GetObjectItemCaseSensitive(segmentEntry, "bpm");
+            cJSON *beatsPerBarItem = cJSON_GetObjectItemCaseSensitive(segmentEntry, "beats-per-bar");
+            cJSON *offsetItem = cJSON_GetObjectItemCaseSensitive(segmentEntry, "offset");
+            cJSON *quantizeItem = cJSON_GetObjectItemCaseSensitive(segmentEntry, "quantize");
+            seg->bpm = (cJSON_IsNumber(bpmItem) && bpmItem->valuedouble > 0) ? (float)bpmItem->valuedouble : 0.0f;
+            seg->beatsPerBar = (cJSON_IsNumber(beatsPerBarItem) && beatsPerBarItem->valueint > 0) ? beatsPerBarItem->valueint : 4;
+            seg->beatOffset = cJSON_IsNumber(offsetItem) ? (float)offsetItem->valuedouble : 0.0f;
+            seg->quantizeToBeat = cJSON_IsString(quantizeItem) && strcmp(quantizeItem->valuestring, "beat") == 0;
+
             levels[*levelCount].segmentCount++;
         }
+
+        // Levels without a layer go under "NONE"; a key the map lacks gets its own
+        // group, or the last one once MAX_LAYERS are in use
+        cJSON *layerItem = cJSON_GetObjectItemCaseSensitive(levelEntry, "layer");
+        int layer = FindLayer(state, cJSON_IsString(layerItem) ? layerItem->valuestring : "NONE", true);
+        if (layer < 0) layer = state->layerCount - 1;
+        levels[*levelCount].layer = layer;
+        if (!AddLayerLevel(&state->layers[layer], *levelCount)) {
+            printf("Warning: out of memory, only the first %d levels are loaded\n", *levelCount);
+            break;
+        }
         
         (*levelCount)++;
     }
+
+    // Optional: true preloads every layer, a list of layer keys only those; after the
+    // levels, which may have added groups of their own
+    cJSON *preloadItem = cJSON_GetObjectItemCaseSensitive(jsonRoot, "preload");
+    cJSON *preloadLayers = cJSON_IsArray(preloadItem) ? preloadItem : NULL;
+    cJSON *preloadEntry = NULL;
+    cJSON_ArrayForEach(preloadEntry, preloadLayers) {
+        if (!cJSON_IsString(preloadEntry)) continue;
+        int layer = FindLayer(state, preloadEntry->valuestring, false);
+        if (layer >= 0) state->layers[layer].preload = true;
+        else printf("Warning: \"preload\" names unknown layer '%s'\n", preloadEntry->valuestring);
+    }
+    for (int i = 0; i < state->layerCount; i++) {
+        if (cJSON_IsTrue(preloadItem)) state->layers[i].preload = true;
+        state->preload |= state->layers[i].preload;
+    }
     
     cJSON_Delete(jsonRoot);
     return *levelCount > 0;
@@ -375,96 +594,329 @@ void HandleSegmentMenu(AppState *state) {
 
         // Handle click
         if (isHovered && IsMouseButtonPressed(MOUSE_LEFT_BUTTON)) {
-            Segment *oldSeg = &currentLevel->segments[currentLevel->currentSegment];
-            StopMusicStream(oldSeg->free);
-            if (oldSeg->hasCombat) StopMusicStream(oldSeg->combat);
-
-            currentLevel->currentSegment = i;
-            Segment *newSeg = &currentLevel->segments[i];
-            PlayMusicStream(newSeg->free);
-            if (newSeg->hasCombat) {
-                PlayMusicStream(newSeg->combat);
-                SetMusicVolume(newSeg->free, state->persistentCombat ? 0.0f : 1.0f);
-                SetMusicVolume(newSeg->combat, state->persistentCombat ? 1.0f : 0.0f);
-            }
+            PushPlaybackCommand(state, PLAYBACK_PLAY_SEGMENT, i, 0);
             state->showSegmentMenu = false;
         }
     }
 }
 
-void GetNextSegment(AppState *state, Level *currentLevel, bool *levelChanged) {
-    *levelChanged = false;
-    
-    // If we're at the last segment of current level
-    if (currentLevel->currentSegment >= currentLevel->segmentCount - 1) {
-        // Try to move to next level
-        int nextLevelIndex = GetNextLevelIndex(state);
-        if (nextLevelIndex != -1) {
-            state->currentPlaying = nextLevelIndex;
-            state->levels[nextLevelIndex].currentSegment = 0;
-            *levelChanged = true;
+void PushPlaybackCommand(AppState *state, PlaybackCommandType type, int a, int b) {
+    if (state->commandCount >= MAX_PLAYBACK_COMMANDS) {
+        printf("Warning: Playback command queue full, dropping command %d\n", type);
+        return;
+    }
+    state->commands[state->commandCount++] = (PlaybackCommand){ type, a, b, GetTime() };
+}
+
+bool StepPlaybackTarget(AppState *state, int *level, int *segment, int direction) {
+    if (direction > 0) {
+        if (*segment < state->levels[*level].segmentCount - 1) {
+            (*segment)++;
+            return true;
+        }
+        if (*level < state->levelCount - 1) {
+            (*level)++;
+            *segment = 0;
+            return true;
         }
     } else {
-        // Just move to next segment
-        currentLevel->currentSegment++;
+        if (*segment > 0) {
+            (*segment)--;
+            return true;
+        }
+        if (*level > 0) {
+            (*level)--;
+            *segment = state->levels[*level].segmentCount - 1;
+            return true;
+        }
     }
+    return false;
 }
 
-int GetNextLevelIndex(AppState *state) {
-    if (state->currentPlaying >= state->levelCount - 1) {
-        return -1; // No next level available
+void ProcessPlaybackCommands(AppState *state) {
+    UpdateScheduledSwitch(state, false);
+
+    // Fold the batch into a target, then touch the streams at most once. A switch
+    // waiting for its bar counts as where playback is headed
+    int level = state->currentPlaying;
+    int segment = (level != -1) ? state->levels[level].currentSegment : 0;
+    if (state->hasPendingNavigation) {
+        level = state->pendingLevel;
+        segment = state->pendingSegment;
+    } else if (state->hasScheduledSwitch) {
+        level = state->scheduledLevel;
+        segment = state->scheduledSegment;
+    }
+    bool paused = state->isPaused;
+    bool combat = state->persistentCombat;
+    bool repeat = state->repeatSegment;
+    bool restart = false;
+    bool navigated = false;
+    bool trackEnded = false;
+    int seekFrame = -1;
+    double seekTime = 0.0;
+    double playTime = 0.0;
+
+    for (int i = 0; i < state->commandCount; i++) {
+        PlaybackCommand *cmd = &state->commands[i];
+        switch (cmd->type) {
+            case PLAYBACK_PLAY_LEVEL:
+                if (cmd->a < 0 || cmd->a >= state->levelCount) break;
+                level = cmd->a;
+                segment = (cmd->b >= 0 && cmd->b < state->levels[level].segmentCount) ? cmd->b : 0;
+                restart = true;
+                paused = false;
+                playTime = cmd->time;
+                break;
+            case PLAYBACK_PLAY_SEGMENT:
+                if (level == -1 || cmd->a < 0 || cmd->a >= state->levels[level].segmentCount) break;
+                segment = cmd->a;
+                restart = true;
+                paused = false;
+                break;
+            case PLAYBACK_NEXT:
+            case PLAYBACK_PREVIOUS:
+                if (level == -1) break;
+                navigated |= StepPlaybackTarget(state, &level, &segment, cmd->type == PLAYBACK_NEXT ? 1 : -1);
+                break;
+            case PLAYBACK_TRACK_END:
+                // Repeat or move on; past the last segment of the last level it starts over
+                if (level == -1) break;
+                if (!repeat && !state->hasScheduledSwitch) StepPlaybackTarget(state, &level, &segment, 1);
+                restart = true;
+                trackEnded = true;
+                paused = false;
+                break;
+            case PLAYBACK_TOGGLE_PAUSE: paused = !paused; break;
+            case PLAYBACK_SET_PAUSE: paused = (cmd->a != 0); break;
+            case PLAYBACK_TOGGLE_COMBAT: combat = !combat; break;
+            case PLAYBACK_SET_COMBAT: combat = (cmd->a != 0); break;
+            case PLAYBACK_TOGGLE_REPEAT: repeat = !repeat; break;
+            case PLAYBACK_SEEK:
+                seekFrame = cmd->a;
+                seekTime = cmd->time;
+                break;
+        }
+    }
+    state->commandCount = 0;
+
+    // Rapid next/previous presses settle on one target before any stream is touched
+    if (navigated && !restart) {
+        state->hasPendingNavigation = true;
+        state->pendingLevel = level;
+        state->pendingSegment = segment;
+        state->pendingDeadline = GetTime() + NAVIGATION_SETTLE_TIME;
+    }
+    bool settled = state->hasPendingNavigation && GetTime() >= state->pendingDeadline;
+
+    bool combatChanged = (combat != state->persistentCombat);
+    state->persistentCombat = combat;
+    state->repeatSegment = repeat;
+    state->repeatBtn.color = repeat ? RED : GRAY;
+
+    if (restart || settled) {
+        state->hasPendingNavigation = false;
+        state->hasScheduledSwitch = false;
+        bool sameSegment = (level == state->currentPlaying && segment == state->levels[level].currentSegment);
+        bool prefetched = state->levels[level].segments[segment].prefetched;
+        double startTime = GetTime();
+        unsigned long long startClock = GetAudioClock();
+
+        if (restart || !sameSegment) {
+            if (state->currentPlaying == -1) {
+                state->currentPlaying = level;
+                state->levels[level].currentSegment = segment;
+                RecordDecoderCacheLookup(state->levels[level].segments[segment].streamsLoaded);
+                PlaySegment(state, &state->levels[level].segments[segment], 0.0f, 0);
+                state->showSegmentMenu = false;
+                state->isPaused = false;
+            } else {
+                // A finished track has nothing left to fade, and a restart cannot overlap itself.
+                // Switching away from a segment with a tempo waits for its next bar
+                Level *currentLevel = &state->levels[state->currentPlaying];
+                bool crossfade = !sameSegment && !trackEnded;
+                unsigned long long boundary = 0;
+                if (crossfade && !state->isPaused) {
+                    boundary = GetNextBoundaryClock(&currentLevel->segments[currentLevel->currentSegment],
+                                                    GetAudioClock() + SWITCH_LEAD_FRAMES);
+                }
+
+                state->hasScheduledSwitch = true;
+                state->scheduledLevel = level;
+                state->scheduledSegment = segment;
+                state->scheduledCrossfade = crossfade;
+                state->scheduledClock = boundary;
+                UpdateScheduledSwitch(state, boundary == 0);
+                if (boundary == 0) state->isPaused = false;
+            }
+
+            // Only a level picked to start at once; waiting for a bar is not latency
+            if (playTime > 0.0 && !state->hasScheduledSwitch) {
+                state->playPending = true;
+                state->playPrefetched = prefetched;
+                state->playRequestTime = playTime;
+                state->playStartTime = startTime;
+                state->playClock = startClock;
+            }
+        }
+    }
+
+    if (combatChanged) {
+        // Combat follows the bar too, on the exact frame
+        float intensity = combat ? 1.0f : 0.0f;
+        unsigned long long boundary = 0;
+        if (state->currentPlaying != -1 && !state->isPaused) {
+            Level *currentLevel = &state->levels[state->currentPlaying];
+            boundary = GetNextBoundaryClock(&currentLevel->segments[currentLevel->currentSegment], GetAudioClock());
+        }
+        ScheduleCombatIntensity(intensity, boundary);
+        if (boundary == 0) SetCombatIntensity(intensity);
+    }
+    if (paused != state->isPaused) {
+        // Pausing cannot wait for a bar that will not come
+        if (paused) UpdateScheduledSwitch(state, true);
+        state->isPaused = paused;
+        HandleMusicPause(state);
+    }
+
+    // A seek only applies to the segment that was playing when it was requested,
+    // and not while a switch away from it is waiting for its bar
+    if (seekFrame >= 0 && !restart && !settled && !state->hasScheduledSwitch && state->currentPlaying != -1) {
+        Level *level = &state->levels[state->currentPlaying];
+        state->seekRequestTime = seekTime;
+        SeekSegment(state, &level->segments[level->currentSegment], seekFrame);
     }
-    return state->currentPlaying + 1;
 }
 
-void HandleMusicTransition(AppState *state, Level *currentLevel, Level *newLevel, int newSegment) {
-    // Stop current music
-    Segment *oldSeg = &currentLevel->segments[currentLevel->currentSegment];
-    StopMusicStream(oldSeg->free);
-    if (oldSeg->hasCombat) StopMusicStream(oldSeg->combat);
+void HandleMusicTransition(AppState *state, Level *currentLevel, Level *newLevel, int newSegment, bool crossfade,
+                           unsigned long long atClock) {
+    Segment *outgoing = &currentLevel->segments[currentLevel->currentSegment];
+    float fade = 0.0f;
+    if (crossfade && !state->isPaused) fade = (newLevel->crossfade >= 0.0f) ? newLevel->crossfade : state->crossfade;
+
+    // Only two segments overlap at a time; one still fading from an earlier switch is cut.
+    // The outgoing segment keeps playing until the clock it is cut or faded on
+    StopFadingSegment(state);
+    if (fade > 0.0f || atClock != 0) {
+        for (int i = 0; i < outgoing->stemCount; i++) FadeOutStreamMonitor(outgoing->stems[i].monitor, fade, atClock);
+        state->fadingSegment = outgoing;
+        state->fadingLevel = currentLevel;
+    } else {
+        StopSegment(outgoing);
+        RewarmSegment(outgoing);
+    }
 
     // Start new music
+    Segment *incoming = &newLevel->segments[newSegment];
+    if (incoming != outgoing) RecordDecoderCacheLookup(incoming->streamsLoaded);
     newLevel->currentSegment = newSegment;
-    Segment *newSeg = &newLevel->segments[newSegment];
-    
-    // Make sure looping is disabled and play
-    newSeg->free.looping = false;
-    PlayMusicStream(newSeg->free);
-    
-    if (newSeg->hasCombat) {
-        newSeg->combat.looping = false;
-        PlayMusicStream(newSeg->combat);
-        SetMusicVolume(newSeg->free, state->persistentCombat ? 0.0f : 1.0f);
-        SetMusicVolume(newSeg->combat, state->persistentCombat ? 1.0f : 0.0f);
-    }
+    PlaySegment(state, &newLevel->segments[newSegment], fade, atClock);
     
     state->showSegmentMenu = false;
 }
 
+unsigned long long GetNextBoundaryClock(const Segment *seg, unsigned long long afterClock) {
+    long long anchor;
+    if (seg->bpm <= 0.0f || !GetStreamMonitorAnchor(seg->stems[0].monitor, &anchor)) return 0;
+
+    // Track position at afterClock, then up to the next beat or bar line
+    double rate = GetDeviceSampleRate();
+    double interval = 60.0/seg->bpm*(seg->quantizeToBeat ? 1 : seg->beatsPerBar);
+    double position = ((long long)afterClock - anchor)/rate - seg->beatOffset;
+    double boundary = ceil(position/interval)*interval + seg->beatOffset;
+    long long clock = anchor + (long long)llround(boundary*rate);
+    return (clock > 0) ? (unsigned long long)clock : 0;
+}
+
+void UpdateScheduledSwitch(AppState *state, bool now) {
+    if (!state->hasScheduledSwitch || state->currentPlaying == -1) return;
+
+    // Streams start a little ahead and hold back until the boundary, so they have
+    // to be going before it; past the boundary they start at once
+    unsigned long long clock = GetAudioClock();
+    unsigned long long atClock = state->scheduledClock;
+    if (!now && atClock > clock + SWITCH_LEAD_FRAMES) return;
+    if (now) atClock = 0;
+
+    state->hasScheduledSwitch = false;
+    Level *currentLevel = &state->levels[state->currentPlaying];
+    state->currentPlaying = state->scheduledLevel;
+    HandleMusicTransition(state, currentLevel, &state->levels[state->scheduledLevel], state->scheduledSegment,
+                          state->scheduledCrossfade, atClock);
+}
+
+void StopFadingSegment(AppState *state) {
+    if (state->fadingSegment == NULL) return;
+    // Left warm in the decoder cache, ready to start again from the top, once
+    // the segment taking over has started
+    StopSegment(state->fadingSegment);
+    RewarmSegment(state->fadingSegment);
+    state->fadingSegment = NULL;
+    state->fadingLevel = NULL;
+}
+
 void HandleMusicEnd(AppState *state) {
     if (state->currentPlaying == -1) return;
     
     Level *currentLevel = &state->levels[state->currentPlaying];
     Segment *currentSeg = &currentLevel->segments[currentLevel->currentSegment];
     
-    // Check if music has ended
-    if (!IsMusicStreamPlaying(currentSeg->free) && state->isPaused == false) {
-        printf("Music ended!\n");
-        if (state->repeatSegment) {
-            RestartCurrentSegment(state);
-        } else {
-            bool levelChanged = false;
-            GetNextSegment(state, currentLevel, &levelChanged);
-            
-            if (levelChanged) {
-                HandleMusicTransition(state, currentLevel, 
-                                   &state->levels[state->currentPlaying], 0);
-            } else if (currentLevel->currentSegment < currentLevel->segmentCount) {
-                HandleMusicTransition(state, currentLevel, 
-                                   currentLevel, currentLevel->currentSegment);
+    // The audio thread reports the exact frame the master stem ran out on
+    bool ended = false;
+    AudioEvent event;
+    while (PollAudioEvent(&event)) {
+        if (event.type == AUDIO_EVENT_FADED_OUT && state->fadingSegment != NULL &&
+            event.monitor == state->fadingSegment->stems[0].monitor) {
+            StopFadingSegment(state);
+            continue;
+        }
+        if (event.monitor != currentSeg->stems[0].monitor) continue;
+        if (event.type == AUDIO_EVENT_END_OF_STREAM) {
+            printf("Music ended at device frame %llu\n", event.clock);
+            ended = true;
+        } else if (event.type == AUDIO_EVENT_STARTED) {
+            // The first start is also a click's or a seek's, so it is measured both ways
+            if (!state->firstAudioReported) {
+                // GetTime counts from the window opening; the stream starts within this frame
+                state->firstAudioReported = true;
+                float seconds = (float)GetTime();
+                RecordTimeToFirstAudio(seconds, state->resumedSession);
+                printf("First audio %.3f s after startup\n", seconds);
             }
+            if (state->seekPending) {
+                // Wait for the frame to apply the seek, plus the audio mixed before the new position
+                state->seekPending = false;
+                double mixed = (event.clock > state->seekClock) ? (double)(event.clock - state->seekClock)/GetDeviceSampleRate() : 0.0;
+                float latencyMs = (float)((state->seekStartTime - state->seekRequestTime) + mixed)*1000.0f;
+                RecordSeekLatency(latencyMs);
+                printf("Seek latency %.1f ms (buffer %.1f ms)\n", latencyMs,
+                       GetStreamBufferSeconds(currentSeg->stems[0].music, currentSeg->bufferFrames)*500.0f);
+            } else if (state->playPending) {
+                // Same measure as a seek, from the click to the first frame in the mixer
+                state->playPending = false;
+                double mixed = (event.clock > state->playClock) ? (double)(event.clock - state->playClock)/GetDeviceSampleRate() : 0.0;
+                float latencyMs = (float)((state->playStartTime - state->playRequestTime) + mixed)*1000.0f;
+                RecordPlayLatency(latencyMs, state->playPrefetched);
+                printf("Play latency %.1f ms (%s)\n", latencyMs, state->playPrefetched ? "prefetched" : "cold");
+            }
+        }
+    }
+
+    // Streams that could not be opened never start, so there is no end to wait for.
+    // It is reported once; a segment on repeat stays silent rather than opening its
+    // files again every frame, and playback stops once every segment failed in a row
+    if (currentSeg->loadFailed) {
+        currentSeg->loadFailed = false;
+        int segmentCount = 0;
+        for (int i = 0; i < state->levelCount; i++) segmentCount += state->levels[i].segmentCount;
+        if (++state->failedStarts >= segmentCount) {
+            printf("Error: no segment could be opened, playback stopped\n");
+        } else if (!state->repeatSegment) {
+            ended = true;
         }
     }
+
+    if (ended) PushPlaybackCommand(state, PLAYBACK_TRACK_END, 0, 0);
 }
 
 void RestartCurrentSegment(AppState *state) {
@@ -473,26 +925,315 @@ void RestartCurrentSegment(AppState *state) {
     Level *currentLevel = &state->levels[state->currentPlaying];
     Segment *currentSeg = &currentLevel->segments[currentLevel->currentSegment];
     
-    StopMusicStream(currentSeg->free);
-    PlayMusicStream(currentSeg->free);
-    
-    if (currentSeg->hasCombat) {
-        StopMusicStream(currentSeg->combat);
-        PlayMusicStream(currentSeg->combat);
-        SetMusicVolume(currentSeg->free, state->persistentCombat ? 0.0f : 1.0f);
-        SetMusicVolume(currentSeg->combat, state->persistentCombat ? 1.0f : 0.0f);
-    }
+    StopSegment(currentSeg);
+    PlaySegment(state, currentSeg, 0.0f, 0);
 }
 
 void HandleMusicPause(AppState *state) {
     if (state->currentPlaying == -1) return;
+    if (state->isPaused) StopFadingSegment(state);
     
     Segment *currentSeg = &state->levels[state->currentPlaying].segments[state->levels[state->currentPlaying].currentSegment];
-    if (state->isPaused) {
-        PauseMusicStream(currentSeg->free);
-        if (currentSeg->hasCombat) PauseMusicStream(currentSeg->combat);
-    } else {
-        ResumeMusicStream(currentSeg->free);
-        if (currentSeg->hasCombat) ResumeMusicStream(currentSeg->combat);
+    // Streams held by a seek were never started, resuming would not start them
+    bool held = currentSeg->held && !state->isPaused;
+    currentSeg->held = false;
+    for (int i = 0; i < currentSeg->stemCount; i++) {
+        if (state->isPaused) PauseMusicStream(currentSeg->stems[i].music);
+        else if (held) PlayMusicStream(currentSeg->stems[i].music);
+        else ResumeMusicStream(currentSeg->stems[i].music);
+    }
+}
+
+// Decode the first buffers of every stem before any of them starts, so they
+// start together and without a stretch of silence. A prefetched segment has them
+// already and the update is a no-op. Held stems are left stopped, see HandleMusicPause
+static void StartSegmentStems(Segment *seg, unsigned int startFrame, float fadeIn, unsigned long long startClock, bool hold) {
+    seg->prefetched = false;
+    seg->held = hold;
+    for (int i = 0; i < seg->stemCount; i++) {
+        Stem *stem = &seg->stems[i];
+        ResetStreamHealth(&stem->health);
+        UpdateMusicStream(stem->music);
+        StemCurve curve = stem->curve;
+        curve.gain *= stem->normalization;
+        stem->monitor = AttachStreamMonitor(stem->music, curve, startFrame, fadeIn, startClock);
     }
-}
\ No newline at end of file
+    if (hold) return;
+    for (int i = 0; i < seg->stemCount; i++) PlayMusicStream(seg->stems[i].music);
+}
+
+// Opens the streams if the decoder cache does not have them, and applies a
+// buffer size picked since they were opened
+static bool PrepareSegmentStreams(AppState *state, Segment *seg) {
+    UseSegmentStreams(seg);
+    if (!CheckOutSegmentStreams(state, seg)) return false;
+    if (seg->adaptiveBuffer) {
+        int frames = PickAdaptiveBufferFrames();
+        if (frames != seg->bufferFrames) {
+            seg->bufferFrames = frames;
+            seg->needsReload = true;
+        }
+    }
+    if (seg->needsReload) ReloadSegmentStreams(seg, true);
+    return true;
+}
+
+// A segment that cannot be played is marked for HandleMusicEnd, which moves on from it
+static bool OpenSegmentForPlayback(AppState *state, Segment *seg) {
+    seg->loadFailed = !PrepareSegmentStreams(state, seg) || seg->stems[0].music.ctxData == NULL ||
+                      seg->stems[0].music.stream.sampleRate == 0;
+    if (seg->loadFailed) {
+        printf("Error: could not open the streams of segment '%s'\n", seg->name);
+        return false;
+    }
+    state->failedStarts = 0;
+    return true;
+}
+
+void PlaySegment(AppState *state, Segment *seg, float fadeIn, unsigned long long startClock) {
+    if (!OpenSegmentForPlayback(state, seg)) return;
+    StartSegmentStems(seg, 0, fadeIn, startClock, false);
+}
+
+void PlaySegmentFrom(AppState *state, Segment *seg, int frame) {
+    if (!OpenSegmentForPlayback(state, seg)) return;
+    // raylib plays what is buffered before seeking, so the prefetched start has to go
+    DiscardSegmentPrefetch(seg);
+    Music master = seg->stems[0].music;
+    if (frame >= (int)master.frameCount) frame = (int)master.frameCount - 1;
+    if (frame < 0) frame = 0;
+
+    // Stems share the master's rate, so the same position lands them on the same frame
+    float position = (frame + 0.5f)/master.stream.sampleRate;
+    for (int i = 0; i < seg->stemCount; i++) SeekMusicStream(seg->stems[i].music, position);
+    // While paused the streams only get positioned, so nothing is heard until resume
+    StartSegmentStems(seg, (unsigned int)frame, 0.0f, 0, state->isPaused);
+}
+
+void StopSegment(Segment *seg) {
+    for (int i = 0; i < seg->stemCount; i++) {
+        StopMusicStream(seg->stems[i].music);
+        DetachStreamMonitor(seg->stems[i].monitor);
+        seg->stems[i].monitor = 0;
+    }
+    seg->held = false;
+}
+
+// raylib converts each stream to the device rate on its own, so stems at different
+// rates drift apart; they switch to a copy converted to the master's rate once the
+// job worker has it in the cache, see UpdateResampling
+static void MatchSegmentRates(Segment *seg, bool urgent) {
+    seg->resamplePending = false;
+    if (seg->stems[0].music.ctxData == NULL) return;
+
+    unsigned int sampleRate = seg->stems[0].music.stream.sampleRate;
+    for (int i = 1; i < seg->stemCount; i++) {
+        Stem *stem = &seg->stems[i];
+        if (stem->music.ctxData == NULL || stem->resampledFile != NULL || stem->music.stream.sampleRate == sampleRate) continue;
+
+        if (!stem->rateWarned) {
+            printf("Warning: stem '%s' of segment '%s' does not match the sample rate of stem '%s'\n",
+                   stem->name, seg->name, seg->stems[0].name);
+            stem->rateWarned = true;
+        }
+        // A failed conversion is reported by its job
+        const char *file = NULL;
+        ResampleStatus status = GetResampledFile(stem->path, (int)sampleRate, urgent, &file);
+        if (status == RESAMPLE_QUEUED) seg->resamplePending = true;
+        if (status != RESAMPLE_READY) continue;
+
+        UnloadMusicStream(stem->music);
+        stem->resampledFile = file;
+        stem->music = LoadSegmentMusic(stem, seg->bufferFrames);
+    }
+}
+
+void LoadSegmentStreams(Segment *seg, bool urgent) {
+    if (seg->streamsLoaded) return;
+    seg->streamsLoaded = true;
+
+    for (int i = 0; i < seg->stemCount; i++) {
+        Stem *stem = &seg->stems[i];
+        stem->resampledFile = NULL;
+        stem->music = LoadSegmentMusic(stem, seg->bufferFrames);
+    }
+    MatchSegmentRates(seg, urgent);
+    CountSegmentStreams(seg);
+}
+
+void UnloadSegmentStreams(Segment *seg) {
+    if (!seg->streamsLoaded) return;
+    seg->streamsLoaded = false;
+    seg->prefetched = false;
+    seg->resamplePending = false;
+
+    for (int i = 0; i < seg->stemCount; i++) {
+        UnloadMusicStream(seg->stems[i].music);
+        seg->stems[i].music = (Music){ 0 };
+        seg->stems[i].resampledFile = NULL;
+    }
+    CountSegmentStreams(seg);
+}
+
+void SeekSegment(AppState *state, Segment *seg, int frame) {
+    Music master = seg->stems[0].music;
+    if (master.ctxData == NULL || master.stream.sampleRate == 0) return;
+
+    // raylib keeps playing what is already queued after a seek, so stop every stem
+    // to drop its buffers and refill them from the new position
+    StopSegment(seg);
+
+    // Latency is only meaningful when the streams start right away
+    state->seekPending = !state->isPaused;
+    state->seekStartTime = GetTime();
+    state->seekClock = GetAudioClock();
+    PlaySegmentFrom(state, seg, frame);
+}
+
+void ReloadSegmentStreams(Segment *seg, bool urgent) {
+    // Stream buffers are allocated on load, so a new size needs fresh streams;
+    // converted stems keep their copy, and ones still waiting pick up a landed copy
+    for (int i = 0; i < seg->stemCount; i++) {
+        Stem *stem = &seg->stems[i];
+        UnloadMusicStream(stem->music);
+        stem->music = LoadSegmentMusic(stem, seg->bufferFrames);
+    }
+    MatchSegmentRates(seg, urgent);
+    CountSegmentStreams(seg);
+    seg->needsReload = false;
+    seg->prefetched = false;
+}
+
+// Opens the streams and decodes their first buffers without starting them, so
+// playing the segment from its start only hands them to the mixer
+void PrefetchSegment(AppState *state, Segment *seg) {
+    if (seg->prefetched || seg->stems[0].monitor != 0) return;
+    if (!PrepareSegmentStreams(state, seg)) return;
+    for (int i = 0; i < seg->stemCount; i++) UpdateMusicStream(seg->stems[i].music);
+    seg->prefetched = true;
+}
+
+void DiscardSegmentPrefetch(Segment *seg) {
+    if (!seg->prefetched) return;
+    seg->prefetched = false;
+
+    // Stopping marks the buffers as played and rewinds the decoder; the streams stay open
+    for (int i = 0; i < seg->stemCount; i++) StopMusicStream(seg->stems[i].music);
+}
+
+void UpdateHoverPrefetch(AppState *state, int level, int segment) {
+    if (level != state->hoverLevel || segment != state->hoverSegment) {
+        state->hoverLevel = level;
+        state->hoverSegment = segment;
+        state->hoverStart = GetTime();
+    }
+    // Off the tiles the prefetched segment stays warm, but can be closed like any idle one
+    if (level == -1) state->prefetchSegment = NULL;
+    if (level == -1 || GetTime() - state->hoverStart < HOVER_PREFETCH_DELAY) return;
+
+    Segment *seg = &state->levels[level].segments[segment];
+    if (seg == state->prefetchSegment) return;
+
+    // One hover prefetch at a time. The previous one is kept if a switch to it is
+    // waiting for its bar; a segment that is playing is left alone
+    Segment *previous = state->prefetchSegment;
+    bool scheduled = state->hasScheduledSwitch &&
+                     previous == &state->levels[state->scheduledLevel].segments[state->scheduledSegment];
+    if (previous != NULL && !scheduled) DiscardSegmentPrefetch(previous);
+    PrefetchSegment(state, seg);
+    state->prefetchSegment = seg;
+}
+
+static bool UpdateSegmentStem(Level *level, Segment *seg, Stem *stem) {
+    if (!UpdateMonitoredStream(stem->music, seg->bufferFrames, &stem->health)) return false;
+
+    RecordUnderrun(level->name, seg->name, stem->name, (float)(stem->health.lastGap*1000.0),
+                   GetStreamBufferSeconds(stem->music, seg->bufferFrames)*1000.0f);
+    return true;
+}
+
+static void UpdateSegment(AppState *state, Level *level, Segment *seg) {
+    // All stems are fed in the same frame so they stay in lockstep
+    bool starved = false;
+    for (int i = 0; i < seg->stemCount; i++) {
+        starved |= UpdateSegmentStem(level, seg, &seg->stems[i]);
+    }
+
+    // Bigger buffers take effect the next time the segment starts
+    if (starved && seg->adaptiveBuffer) {
+        NoteAdaptiveUnderrun(seg->bufferFrames);
+    } else if (starved && state->autoGrowBuffers) {
+        int grown = GrowBufferFrames(seg->bufferFrames, seg->stems[0].music.stream.sampleRate);
+        if (grown != seg->bufferFrames) {
+            seg->bufferFrames = grown;
+            seg->needsReload = true;
+            printf("Growing stream buffer of '%s' to %d frames\n", seg->name, grown);
+        }
+    }
+}
+
+void UpdateSegmentStreams(AppState *state) {
+    if (state->currentPlaying == -1) return;
+
+    double start = GetTime();
+    Level *currentLevel = &state->levels[state->currentPlaying];
+    UpdateSegment(state, currentLevel, &currentLevel->segments[currentLevel->currentSegment]);
+
+    // The outgoing segment of a crossfade keeps decoding until it is silent
+    bool crossfading = (state->fadingSegment != NULL);
+    if (crossfading) UpdateSegment(state, state->fadingLevel, state->fadingSegment);
+    RecordStreamUpdateTime(GetTime() - start, crossfading);
+}
+
+void FreeLevels(AppState *state) {
+    for (int i = 0; i < state->layerCount; i++) {
+        free(state->layers[i].levels);
+        state->layers[i].levels = NULL;
+        state->layers[i].levelCount = state->layers[i].levelCapacity = 0;
+    }
+    free(state->levels);
+    free(state->searchSegment);
+    state->levels = NULL;
+    state->searchSegment = NULL;
+    state->levelCount = 0;
+}
+
+void SetLayerCollapsed(AppState *state, int layer, bool collapsed) {
+    LayerGroup *group = &state->layers[layer];
+    group->collapsed = collapsed;
+
+    // Streamed back in as the group is expanded and scrolled to
+    if (collapsed) {
+        for (int i = 0; i < group->levelCount; i++) UnloadLevelThumbnail(&state->levels[group->levels[i]]);
+    }
+}
+
+bool IsLayerExpanded(const AppState *state, int layer) {
+    return !state->layers[layer].collapsed || state->searchQuery[0] != '\0';
+}
+
+bool UpdateAssetLoading(AppState *state, double budget) {
+    if (state->assetsLoaded) return true;
+
+    // Catalog order until the decoder cache is full; at least one segment per
+    // frame, so a slow disk still makes progress
+    double start = GetTime();
+    do {
+        Level *level = (state->loadLevel < state->levelCount) ? &state->levels[state->loadLevel] : NULL;
+        Segment *seg = (level != NULL && state->loadSegment < level->segmentCount) ? &level->segments[state->loadSegment] : NULL;
+        if (level == NULL || (seg != NULL && !seg->streamsLoaded && !DecoderCacheHasRoom(state, seg))) {
+            state->assetsLoaded = true;
+            printf("Streams warmed %.2f s after startup\n", GetTime());
+            return true;
+        }
+
+        if (seg != NULL) {
+            CheckOutSegmentStreams(state, seg);
+            state->loadSegment++;
+        } else {
+            state->loadLevel++;
+            state->loadSegment = 0;
+        }
+    } while (GetTime() - start < budget);
+    return false;
+}
@@ -3,9 +3,11 @@
 
 #include "raylib.h"
 #include "./cjson/cJSON.h"
+#include "audio.h"
 
 // Common defines
 #define CONTROL_PANEL_HEIGHT 50
+#define VISUALIZER_HEIGHT 64
 #define SCROLL_SPEED 30.0f
 
 #define FONT_SIZE_SMALL 11
@@ -17,25 +19,114 @@
 #define DARKERRED (Color){ 54, 8, 8, 255 }
 #define MIDRED (Color){ 130, 8, 8, 255 }
 
-#define MAX_LEVELS 50
+// Segments are stored inline in their level, about 56 KB each
 #define MAX_SEGMENTS 10
 
+#define MAX_STEMS 8
+
+#define MAX_LAYERS 16
+#define LAYER_HEADER_HEIGHT 30
+
+#define SEARCH_QUERY_LENGTH 64
+#define SEARCH_BAR_HEIGHT 28
+
+// Analysis results and other derived data, relative to the working directory
+#define CACHE_FOLDER "cache"
+
+// One layer of a segment. All stems of a segment play in lockstep and are mixed
+// by their curve; the first stem is the master that decides when the segment ends
+typedef struct Stem {
+    char name[32];
+    char path[512];
+    Music music;
+    StemCurve curve;
+    float normalization;        // loudness normalization gain, 1 until measured
+    StreamHealth health;
+    int monitor;                // audio thread monitor while playing, 0 = none
+    const char *resampledFile;  // converted copy music streams from when the file's rate differs from stem 0
+    bool rateWarned;            // the mismatch was reported, streams reload often
+    bool fileBacked;            // music holds its file open, rather than reading from memory
+} Stem;
+
 typedef struct Segment {
     char name[256];
-    Music free;
-    Music combat;
-    bool hasCombat;
+    Stem stems[MAX_STEMS];
+    int stemCount;
+    bool hasCombat;             // more than one stem, so the combat intensity does something
+    int bufferFrames;           // stream sub-buffer size, 0 = raylib default
+    bool adaptiveBuffer;        // pick bufferFrames from recent underruns on every start
+    bool needsReload;           // buffer size changed since the streams were loaded
+    bool streamsLoaded;         // streams open, loaded in the background or on first play
+    bool prefetched;            // first buffers decoded ahead of a click, not started
+    bool rewarm;                // stopped by a switch, prefetched again on the next frame
+    bool resamplePending;       // a stem plays at its own rate until its conversion lands
+    bool held;                  // seeked while paused: positioned and filled, started on resume
+    bool loadFailed;            // the last play could not open the streams, its end is not reported yet
+    unsigned int streamsUsed;   // decoder cache stamp, higher = played more recently
+    int openFiles;              // counted in the decoder cache totals
+    size_t streamBytes;
+    float bpm;                  // 0 = no tempo, switches and combat changes happen at once
+    int beatsPerBar;
+    float beatOffset;           // seconds from the start of the file to the first downbeat
+    bool quantizeToBeat;        // wait for the next beat instead of the next bar
 } Segment;
 
+#define MAX_PLAYBACK_COMMANDS 64
+#define NAVIGATION_SETTLE_TIME 0.15     // seconds next/previous presses are gathered before switching
+#define SWITCH_LEAD_FRAMES 4096         // device frames before a quantized switch that its streams are started
+#define ASSET_LOAD_BUDGET 0.008         // seconds per frame spent opening streams after startup
+#define HOVER_PREFETCH_DELAY 0.15       // seconds a level tile is hovered before its first segment is prefetched
+
+// Every input source (keys, buttons, menus, end of track) queues one of these,
+// and ProcessPlaybackCommands applies the whole batch once per frame
+typedef enum PlaybackCommandType {
+    PLAYBACK_PLAY_LEVEL = 0,    // a = level, b = segment
+    PLAYBACK_PLAY_SEGMENT,      // a = segment of the level being played
+    PLAYBACK_NEXT,
+    PLAYBACK_PREVIOUS,
+    PLAYBACK_TRACK_END,
+    PLAYBACK_TOGGLE_PAUSE,
+    PLAYBACK_SET_PAUSE,         // a = paused
+    PLAYBACK_TOGGLE_COMBAT,
+    PLAYBACK_SET_COMBAT,        // a = combat
+    PLAYBACK_TOGGLE_REPEAT,
+    PLAYBACK_SEEK,              // a = frame of the first stem
+} PlaybackCommandType;
+
+typedef struct PlaybackCommand {
+    PlaybackCommandType type;
+    int a;
+    int b;
+    double time;                // when it was queued
+} PlaybackCommand;
+
 typedef struct Level {
     char name[256];
     char thumbnailPath[512];
     Texture2D thumbnail;
+    Image thumbnailImage;       // decoded, waiting for upload
+    int thumbnailStatus;        // ThumbnailStatus
+    unsigned int thumbnailUsed;     // frame it was last drawn or requested
     Segment segments[MAX_SEGMENTS];
     int segmentCount;
     int currentSegment;
+    float crossfade;            // seconds into this level's segments, < 0 = the global value
+    int layer;                  // group it is listed under
 } Level;
 
+// Levels grouped by their "layer" key, in the order of the "layers" map. A
+// collapsed group is only its header: its levels are not laid out or drawn,
+// and their thumbnails are evicted
+typedef struct LayerGroup {
+    char key[32];
+    char name[128];
+    bool collapsed;
+    bool preload;               // audio read into memory at startup
+    int *levels;                // catalog order
+    int levelCount;
+    int levelCapacity;
+} LayerGroup;
+
 typedef struct Button {
     Rectangle bounds;
     const char *text;
@@ -57,21 +148,80 @@ typedef struct AppState {
     Button combatBtn;
     Button segmentBtn;
     Button repeatBtn;
-    Level levels[MAX_LEVELS];
+    Level *levels;              // one per entry of the "levels" map, allocated once by ParseJSONData
     int levelCount;
+    LayerGroup layers[MAX_LAYERS];
+    int layerCount;
+    bool showLayerHeaders;      // data.json has a "layers" map
+    float contentHeight;        // grid height as last drawn, for the scroll limit
+    float scrollVelocity;       // pixels per second, smoothed
+    size_t thumbnailBudget;     // bytes of thumbnail textures kept resident
+    int decoderCacheFiles;      // stem files kept open across all segments
+    size_t decoderCacheBudget;  // bytes of stream buffers kept
+    int maxOpenFiles;           // stem files open at once, 0 = from the process limit
+    char packPath[512];         // empty = loose files only
+    bool preload;               // some layers are read into memory at startup
+    size_t preloadBudget;       // bytes
     int currentPlaying;
     bool isPaused;
     bool persistentCombat;
     bool showSegmentMenu;
     bool repeatSegment;
+    bool autoGrowBuffers;
+    int bufferFrames;           // default for segments without their own "buffer-size"
+    bool adaptiveBuffers;
+    char controlSocketPath[108];    // empty = no control socket
+    char sharedMemoryName[64];      // empty = no shared intensity channel
+    bool normalizeLoudness;
+    float loudnessTarget;           // LUFS
+    float crossfade;                // seconds, 0 = hard cut between segments
+    bool visualizer;                // spectrum panel shown at startup
+    Segment *fadingSegment;         // outgoing segment still fading out, NULL = none
+    Level *fadingLevel;
     float scrollY;
     int buttonsPerRow;
     int startX;
     Rectangle progressBar;
+    PlaybackCommand commands[MAX_PLAYBACK_COMMANDS];
+    int commandCount;
+    bool hasPendingNavigation;  // next/previous target waiting for NAVIGATION_SETTLE_TIME
+    int pendingLevel;
+    int pendingSegment;
+    double pendingDeadline;
+    bool hasScheduledSwitch;    // segment switch waiting for the next beat or bar
+    int scheduledLevel;
+    int scheduledSegment;
+    bool scheduledCrossfade;
+    unsigned long long scheduledClock;
+    bool draggingProgress;      // mouse held on the progress bar, seeks on release
+    float dragProgress;
+    bool seekPending;           // waiting for the seeked streams to reach the mixer
+    double seekRequestTime;
+    double seekStartTime;
+    unsigned long long seekClock;   // audio clock when the seeked streams started
+    bool playPending;           // waiting for a clicked level to reach the mixer
+    bool playPrefetched;
+    double playRequestTime;
+    double playStartTime;
+    unsigned long long playClock;
+    int hoverLevel;             // level tile under the mouse, -1 = none
+    int hoverSegment;           // segment a click on it would play
+    double hoverStart;
+    Segment *prefetchSegment;   // last segment prefetched for a hover, NULL = none
+    int loadLevel;              // next level the background loader looks at
+    int loadSegment;
+    bool assetsLoaded;
+    bool firstAudioReported;
+    int failedStarts;           // plays in a row whose streams could not be opened
+    bool resumedSession;        // playback on startup came from the saved session
+    char searchQuery[SEARCH_QUERY_LENGTH];
+    bool searchFocused;
+    int *searchSegment;             // first matching segment of each level, -1 = filtered out
+    int visibleLevelCount;          // levels left in the grid by the search
 } AppState;
 
 char *LoadFileTextCustom(const char *fileName);
-bool ParseJSONData(const char *jsonFileName, Level levels[], int *levelCount);
+bool ParseJSONData(const char *jsonFileName, AppState *state);
 void DrawTextRec(Font font, const char *text, Rectangle rec, float fontSize, float spacing, bool wordWrap, Color tint);
 
 // Button functions
@@ -84,16 +234,45 @@ bool IsButtonClicked(Button button, Vector2 mousePoint);
 void InitializeButtons(AppState *state, int screenWidth, int screenHeight);
 void HandleSegmentMenu(AppState *state);
 
-// Navigation functions
-void GetNextSegment(AppState *state, Level *currentLevel, bool *levelChanged);
-int GetNextLevelIndex(AppState *state);
+// Playback command queue
+void PushPlaybackCommand(AppState *state, PlaybackCommandType type, int a, int b);
+void ProcessPlaybackCommands(AppState *state);
+// Moves to the neighbouring segment in catalog order; false at either end
+bool StepPlaybackTarget(AppState *state, int *level, int *segment, int direction);
 
 // Add after other function declarations
-void HandleMusicTransition(AppState *state, Level *currentLevel, Level *newLevel, int newSegment);
+void HandleMusicTransition(AppState *state, Level *currentLevel, Level *newLevel, int newSegment, bool crossfade,
+                           unsigned long long atClock);
+unsigned long long GetNextBoundaryClock(const Segment *seg, unsigned long long afterClock);
+void UpdateScheduledSwitch(AppState *state, bool now);
 
 // Add new function declarations
 void HandleMusicEnd(AppState *state);
 void RestartCurrentSegment(AppState *state);
 void HandleMusicPause(AppState *state);
 
+// Segment stream functions
+void PlaySegment(AppState *state, Segment *seg, float fadeIn, unsigned long long startClock);
+void StopFadingSegment(AppState *state);
+void StopSegment(Segment *seg);
+void PlaySegmentFrom(AppState *state, Segment *seg, int frame);
+void SeekSegment(AppState *state, Segment *seg, int frame);
+// urgent queues sample rate conversions in front of the job queue, for a
+// segment that is about to play
+void LoadSegmentStreams(Segment *seg, bool urgent);
+void UnloadSegmentStreams(Segment *seg);
+void ReloadSegmentStreams(Segment *seg, bool urgent);
+void PrefetchSegment(AppState *state, Segment *seg);
+void DiscardSegmentPrefetch(Segment *seg);
+void UpdateHoverPrefetch(AppState *state, int level, int segment);
+void UpdateSegmentStreams(AppState *state);
+
+void FreeLevels(AppState *state);
+void SetLayerCollapsed(AppState *state, int layer, bool collapsed);
+// A collapsed group still shows its levels while a search is on
+bool IsLayerExpanded(const AppState *state, int layer);
+
+// Streams not needed yet are opened a few per frame; true once all are
+bool UpdateAssetLoading(AppState *state, double budget);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,113 @@
+#include "jobs.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+typedef struct Job {
+    JobFunction function;
+    void *data;
+} Job;
+
+static Job jobQueue[MAX_QUEUED_JOBS];
+static int jobHead = 0;
+static int jobCount = 0;
+static int runningJobs = 0;
+static _Atomic bool jobsStopping = false;
+
+static pthread_mutex_t jobLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobAvailable = PTHREAD_COND_INITIALIZER;
+static pthread_t jobWorkers[MAX_JOB_WORKERS];
+static int jobWorkerCount = 0;
+
+static void *JobWorker(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&jobLock);
+    while (true) {
+        while (jobCount == 0 && !jobsStopping) pthread_cond_wait(&jobAvailable, &jobLock);
+        if (jobsStopping) break;
+
+        Job job = jobQueue[jobHead];
+        jobHead = (jobHead + 1) % MAX_QUEUED_JOBS;
+        jobCount--;
+        runningJobs++;
+
+        pthread_mutex_unlock(&jobLock);
+        job.function(job.data);
+        pthread_mutex_lock(&jobLock);
+        runningJobs--;
+    }
+    pthread_mutex_unlock(&jobLock);
+    return NULL;
+}
+
+bool InitJobSystem(int workerCount) {
+    if (workerCount <= 0) {
+#ifdef _WIN32
+        workerCount = 2;
+#else
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        workerCount = (cores > 2) ? (int)cores - 1 : 1;
+#endif
+    }
+    if (workerCount > MAX_JOB_WORKERS) workerCount = MAX_JOB_WORKERS;
+
+    jobsStopping = false;
+    for (int i = 0; i < workerCount; i++) {
+        if (pthread_create(&jobWorkers[jobWorkerCount], NULL, JobWorker, NULL) != 0) {
+            printf("Warning: could only start %d of %d job workers\n", jobWorkerCount, workerCount);
+            break;
+        }
+        jobWorkerCount++;
+    }
+    return jobWorkerCount > 0;
+}
+
+bool SubmitJob(JobFunction function, void *data) {
+    pthread_mutex_lock(&jobLock);
+    bool queued = jobWorkerCount > 0 && !jobsStopping && jobCount < MAX_QUEUED_JOBS;
+    if (queued) {
+        jobQueue[(jobHead + jobCount) % MAX_QUEUED_JOBS] = (Job){ function, data };
+        jobCount++;
+        pthread_cond_signal(&jobAvailable);
+    }
+    pthread_mutex_unlock(&jobLock);
+    return queued;
+}
+
+bool SubmitUrgentJob(JobFunction function, void *data) {
+    pthread_mutex_lock(&jobLock);
+    bool queued = jobWorkerCount > 0 && !jobsStopping && jobCount < MAX_QUEUED_JOBS;
+    if (queued) {
+        jobHead = (jobHead + MAX_QUEUED_JOBS - 1) % MAX_QUEUED_JOBS;
+        jobQueue[jobHead] = (Job){ function, data };
+        jobCount++;
+        pthread_cond_signal(&jobAvailable);
+    }
+    pthread_mutex_unlock(&jobLock);
+    return queued;
+}
+
+int GetPendingJobCount(void) {
+    pthread_mutex_lock(&jobLock);
+    int pending = jobCount + runningJobs;
+    pthread_mutex_unlock(&jobLock);
+    return pending;
+}
+
+bool IsJobSystemStopping(void) {
+    return atomic_load_explicit(&jobsStopping, memory_order_relaxed);
+}
+
+void CloseJobSystem(void) {
+    pthread_mutex_lock(&jobLock);
+    jobsStopping = true;
+    jobCount = 0;
+    pthread_cond_broadcast(&jobAvailable);
+    pthread_mutex_unlock(&jobLock);
+
+    for (int i = 0; i < jobWorkerCount; i++) pthread_join(jobWorkers[i], NULL);
+    jobWorkerCount = 0;
+}
@@ -0,0 +1,27 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stdbool.h>
+
+#define MAX_QUEUED_JOBS 1024
+#define MAX_JOB_WORKERS 8
+
+// Small worker pool for background work (analysis, decoding, file IO). Jobs run
+// in submission order on whichever worker is free; they must not touch raylib
+// GPU state or AppState, and hand their results back to the main loop themselves.
+typedef void (*JobFunction)(void *data);
+
+// workerCount 0 = one per core, keeping one core for the main and audio threads
+bool InitJobSystem(int workerCount);
+bool SubmitJob(JobFunction function, void *data);
+// Queued in front of everything waiting, for short jobs playback is about to need
+bool SubmitUrgentJob(JobFunction function, void *data);
+int GetPendingJobCount(void);
+
+// True once CloseJobSystem started; long jobs check it between chunks and give up
+bool IsJobSystemStopping(void);
+
+// Waits for running jobs to finish; jobs still queued are dropped
+void CloseJobSystem(void);
+
+#endif
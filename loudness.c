@@ -0,0 +1,338 @@
+#include "loudness.h"
+#include "jobs.h"
+#include "pack.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOUDNESS_TRUE_PEAK_CHUNK 8192
+
+typedef enum {
+    LOUDNESS_QUEUED,
+    LOUDNESS_DONE,
+    LOUDNESS_FAILED
+} LoudnessStatus;
+
+typedef struct LoudnessTrack {
+    char path[512];
+    long modTime;
+    float integrated;
+    float truePeak;
+    _Atomic int status;         // written by the worker, read by the main loop
+    bool inFlight;              // submitted and not yet picked up by UpdateLoudnessAnalysis
+    bool waiting;               // did not fit the job queue, UpdateLoudnessAnalysis retries
+} LoudnessTrack;
+
+static LoudnessTrack **loudnessTracks = NULL;
+static int loudnessTrackCount = 0;
+static int loudnessTrackCapacity = 0;
+static int loudnessPending = 0;
+static double loudnessStart = 0.0;
+
+// Biquad in direct form I, b and a normalized so a0 = 1
+typedef struct Biquad {
+    double b0, b1, b2, a1, a2;
+    double x1, x2, y1, y2;
+} Biquad;
+
+static double RunBiquad(Biquad *f, double x) {
+    double y = f->b0*x + f->b1*f->x1 + f->b2*f->x2 - f->a1*f->y1 - f->a2*f->y2;
+    f->x2 = f->x1;
+    f->x1 = x;
+    f->y2 = f->y1;
+    f->y1 = y;
+    return y;
+}
+
+// BS.1770 K-weighting (high shelf, then high pass), derived for any sample rate
+static void InitKWeighting(Biquad *shelf, Biquad *highPass, int sampleRate) {
+    double k = tan(DSP_PI*1681.974450955533/sampleRate);
+    double q = 0.7071752369554196;
+    double vh = pow(10.0, 3.999843853973347/20.0);
+    double vb = pow(vh, 0.4996667741545416);
+    double a0 = 1.0 + k/q + k*k;
+    *shelf = (Biquad){
+        .b0 = (vh + vb*k/q + k*k)/a0, .b1 = 2.0*(k*k - vh)/a0, .b2 = (vh - vb*k/q + k*k)/a0,
+        .a1 = 2.0*(k*k - 1.0)/a0, .a2 = (1.0 - k/q + k*k)/a0
+    };
+
+    k = tan(DSP_PI*38.13547087602444/sampleRate);
+    q = 0.5003270373238773;
+    a0 = 1.0 + k/q + k*k;
+    *highPass = (Biquad){ .b0 = 1.0, .b1 = -2.0, .b2 = 1.0, .a1 = 2.0*(k*k - 1.0)/a0, .a2 = (1.0 - k/q + k*k)/a0 };
+}
+
+static float MeasureIntegratedLoudness(const Wave *wave) {
+    // Energy of 100 ms steps; gating blocks are 400 ms, i.e. four steps with 75% overlap
+    int channels = (int)wave->channels;
+    int stepFrames = (int)wave->sampleRate/10;
+    int steps = (int)(wave->frameCount/stepFrames);
+    if (steps < 4) return LOUDNESS_SILENCE;
+
+    double *stepEnergy = (double *)calloc(steps, sizeof(double));
+    if (stepEnergy == NULL) return LOUDNESS_SILENCE;
+
+    for (int c = 0; c < channels; c++) {
+        Biquad shelf, highPass;
+        InitKWeighting(&shelf, &highPass, (int)wave->sampleRate);
+        for (int s = 0; s < steps && !IsJobSystemStopping(); s++) {
+            double sum = 0.0;
+            for (int i = s*stepFrames; i < (s + 1)*stepFrames; i++) {
+                double y = RunBiquad(&highPass, RunBiquad(&shelf, ReadWaveSample(wave, (size_t)i*channels + c)));
+                sum += y*y;
+            }
+            stepEnergy[s] += sum;
+        }
+    }
+
+    int blocks = steps - 3;
+    double *blockEnergy = (double *)malloc(sizeof(double)*blocks);
+    if (blockEnergy == NULL) {
+        free(stepEnergy);
+        return LOUDNESS_SILENCE;
+    }
+    for (int j = 0; j < blocks; j++) {
+        blockEnergy[j] = (stepEnergy[j] + stepEnergy[j + 1] + stepEnergy[j + 2] + stepEnergy[j + 3])/(4.0*stepFrames);
+    }
+
+    // Absolute gate at -70 LUFS, then a relative gate 10 LU below what passed it
+    double absoluteGate = pow(10.0, (LOUDNESS_SILENCE + 0.691)/10.0);
+    double sum = 0.0;
+    int count = 0;
+    for (int j = 0; j < blocks; j++) {
+        if (blockEnergy[j] > absoluteGate) {
+            sum += blockEnergy[j];
+            count++;
+        }
+    }
+    float loudness = LOUDNESS_SILENCE;
+    if (count > 0) {
+        double relativeGate = (sum/count)*pow(10.0, -1.0);
+        sum = 0.0;
+        count = 0;
+        for (int j = 0; j < blocks; j++) {
+            if (blockEnergy[j] > absoluteGate && blockEnergy[j] > relativeGate) {
+                sum += blockEnergy[j];
+                count++;
+            }
+        }
+        if (count > 0) loudness = (float)(-0.691 + 10.0*log10(sum/count));
+    }
+
+    free(blockEnergy);
+    free(stepEnergy);
+    return loudness;
+}
+
+static float MeasureTruePeak(const Wave *wave) {
+    // Upsample 4x in chunks; each chunk reads its filter padding from its neighbours
+    DspResampler resampler;
+    if (!InitDspResampler(&resampler, (int)wave->sampleRate, (int)wave->sampleRate*4)) return 0.0f;
+
+    int channels = (int)wave->channels;
+    int frames = (int)wave->frameCount;
+    float *chunk = (float *)malloc(sizeof(float)*(LOUDNESS_TRUE_PEAK_CHUNK + 2*DSP_RESAMPLER_TAPS));
+    float *upsampled = (float *)malloc(sizeof(float)*LOUDNESS_TRUE_PEAK_CHUNK*4);
+    float peak = 0.0f;
+
+    if (chunk != NULL && upsampled != NULL) {
+        for (int c = 0; c < channels; c++) {
+            for (int start = 0; start < frames && !IsJobSystemStopping(); start += LOUDNESS_TRUE_PEAK_CHUNK) {
+                int length = (frames - start < LOUDNESS_TRUE_PEAK_CHUNK) ? frames - start : LOUDNESS_TRUE_PEAK_CHUNK;
+                for (int i = -DSP_RESAMPLER_TAPS; i < length + DSP_RESAMPLER_TAPS; i++) {
+                    int frame = start + i;
+                    float x = (frame >= 0 && frame < frames) ? ReadWaveSample(wave, (size_t)frame*channels + c) : 0.0f;
+                    chunk[i + DSP_RESAMPLER_TAPS] = x;
+                    if (i >= 0 && i < length && fabsf(x) > peak) peak = fabsf(x);
+                }
+                ResampleChannel(&resampler, upsampled, chunk + DSP_RESAMPLER_TAPS, length);
+                for (int i = 0; i < length*4; i++) {
+                    if (fabsf(upsampled[i]) > peak) peak = fabsf(upsampled[i]);
+                }
+            }
+        }
+    }
+
+    free(upsampled);
+    free(chunk);
+    FreeDspResampler(&resampler);
+    return (peak > 0.0f) ? 20.0f*log10f(peak) : LOUDNESS_SILENCE;
+}
+
+bool MeasureLoudness(const char *path, float *integrated, float *truePeak) {
+    Wave wave = LoadAssetWave(path);
+    if (wave.data == NULL || wave.frameCount == 0 || wave.sampleRate == 0) {
+        UnloadWave(wave);
+        return false;
+    }
+    *integrated = MeasureIntegratedLoudness(&wave);
+    *truePeak = MeasureTruePeak(&wave);
+    UnloadWave(wave);
+    // Cut short by shutdown; failed tracks are not cached, so they are measured next time
+    return !IsJobSystemStopping();
+}
+
+static void LoudnessJob(void *data) {
+    LoudnessTrack *track = (LoudnessTrack *)data;
+    bool measured = MeasureLoudness(track->path, &track->integrated, &track->truePeak);
+    atomic_store_explicit(&track->status, measured ? LOUDNESS_DONE : LOUDNESS_FAILED, memory_order_release);
+}
+
+static LoudnessTrack *AddLoudnessTrack(const char *path, long modTime) {
+    if (loudnessTrackCount == loudnessTrackCapacity) {
+        int capacity = loudnessTrackCapacity ? loudnessTrackCapacity*2 : 64;
+        LoudnessTrack **tracks = (LoudnessTrack **)realloc(loudnessTracks, sizeof(LoudnessTrack *)*capacity);
+        if (tracks == NULL) return NULL;
+        loudnessTracks = tracks;
+        loudnessTrackCapacity = capacity;
+    }
+    LoudnessTrack *track = (LoudnessTrack *)calloc(1, sizeof(LoudnessTrack));
+    if (track == NULL) return NULL;
+    snprintf(track->path, sizeof(track->path), "%s", path);
+    track->modTime = modTime;
+    loudnessTracks[loudnessTrackCount++] = track;
+    return track;
+}
+
+static LoudnessTrack *FindLoudnessTrack(const char *path) {
+    for (int i = 0; i < loudnessTrackCount; i++) {
+        if (strcmp(loudnessTracks[i]->path, path) == 0) return loudnessTracks[i];
+    }
+    return NULL;
+}
+
+// One line per file: "<mtime> <integrated LUFS> <true peak dBTP> <path>"
+static void LoadLoudnessCache(void) {
+    FILE *file = fopen(LOUDNESS_CACHE_FILE, "r");
+    if (file == NULL) return;
+
+    char line[640];
+    while (fgets(line, sizeof(line), file)) {
+        long modTime;
+        float integrated, truePeak;
+        int pathStart = 0;
+        if (sscanf(line, "%ld %f %f %n", &modTime, &integrated, &truePeak, &pathStart) != 3 || pathStart == 0) continue;
+        line[strcspn(line, "\r\n")] = '\0';
+
+        LoudnessTrack *track = AddLoudnessTrack(line + pathStart, modTime);
+        if (track == NULL) break;
+        track->integrated = integrated;
+        track->truePeak = truePeak;
+        atomic_store(&track->status, LOUDNESS_DONE);
+    }
+    fclose(file);
+}
+
+static void SaveLoudnessCache(void) {
+    if (!DirectoryExists(CACHE_FOLDER)) MakeDirectory(CACHE_FOLDER);
+    FILE *file = fopen(LOUDNESS_CACHE_FILE, "w");
+    if (file == NULL) {
+        printf("Warning: could not write %s\n", LOUDNESS_CACHE_FILE);
+        return;
+    }
+    for (int i = 0; i < loudnessTrackCount; i++) {
+        LoudnessTrack *track = loudnessTracks[i];
+        if (atomic_load(&track->status) != LOUDNESS_DONE) continue;
+        fprintf(file, "%ld %.2f %.2f %s\n", track->modTime, track->integrated, track->truePeak, track->path);
+    }
+    fclose(file);
+}
+
+static float GetNormalizationGain(const AppState *state, const LoudnessTrack *track) {
+    if (track->integrated <= LOUDNESS_SILENCE) return 1.0f;
+    float gainDb = state->loudnessTarget - track->integrated;
+    if (track->truePeak + gainDb > LOUDNESS_PEAK_CEILING) gainDb = LOUDNESS_PEAK_CEILING - track->truePeak;
+    return powf(10.0f, gainDb/20.0f);
+}
+
+// Takes effect the next time the stem's segment starts
+static void ApplyLoudnessTrack(AppState *state, LoudnessTrack *track) {
+    float gain = GetNormalizationGain(state, track);
+    for (int i = 0; i < state->levelCount; i++) {
+        Level *level = &state->levels[i];
+        for (int j = 0; j < level->segmentCount; j++) {
+            for (int k = 0; k < level->segments[j].stemCount; k++) {
+                Stem *stem = &level->segments[j].stems[k];
+                if (strcmp(stem->path, track->path) == 0) stem->normalization = gain;
+            }
+        }
+    }
+}
+
+void StartLoudnessAnalysis(AppState *state) {
+    if (!state->normalizeLoudness) return;
+
+    LoadLoudnessCache();
+    loudnessStart = GetTime();
+
+    int cached = 0;
+    for (int i = 0; i < state->levelCount; i++) {
+        Level *level = &state->levels[i];
+        for (int j = 0; j < level->segmentCount; j++) {
+            for (int k = 0; k < level->segments[j].stemCount; k++) {
+                Stem *stem = &level->segments[j].stems[k];
+                long modTime = GetAssetModTime(stem->path);
+                LoudnessTrack *track = FindLoudnessTrack(stem->path);
+
+                // Unchanged since it was measured, or already queued for another stem
+                if (track != NULL && track->modTime == modTime) {
+                    if (atomic_load(&track->status) == LOUDNESS_DONE && !track->inFlight) {
+                        stem->normalization = GetNormalizationGain(state, track);
+                        cached++;
+                    }
+                    continue;
+                }
+
+                if (track == NULL) track = AddLoudnessTrack(stem->path, modTime);
+                if (track == NULL) continue;
+                track->modTime = modTime;
+                atomic_store(&track->status, LOUDNESS_QUEUED);
+                track->inFlight = SubmitJob(LoudnessJob, track);
+                track->waiting = !track->inFlight;
+                loudnessPending++;
+            }
+        }
+    }
+    printf("Loudness: %d stems from cache, %d files queued for analysis\n", cached, loudnessPending);
+}
+
+void UpdateLoudnessAnalysis(AppState *state) {
+    if (loudnessPending == 0) return;
+
+    bool finished = false;
+    for (int i = 0; i < loudnessTrackCount; i++) {
+        LoudnessTrack *track = loudnessTracks[i];
+        if (track->waiting && SubmitJob(LoudnessJob, track)) {
+            track->waiting = false;
+            track->inFlight = true;
+        }
+        if (!track->inFlight) continue;
+        int status = atomic_load_explicit(&track->status, memory_order_acquire);
+        if (status == LOUDNESS_QUEUED) continue;
+
+        track->inFlight = false;
+        loudnessPending--;
+        finished = true;
+        if (status == LOUDNESS_FAILED) {
+            printf("Warning: could not analyse loudness of %s\n", track->path);
+            continue;
+        }
+        ApplyLoudnessTrack(state, track);
+    }
+
+    // Saved as results come in, so an early exit keeps what was measured
+    if (finished) SaveLoudnessCache();
+    if (finished && loudnessPending == 0) {
+        printf("Loudness analysis finished in %.1f s\n", GetTime() - loudnessStart);
+    }
+}
+
+void CloseLoudnessAnalysis(void) {
+    // Workers must be stopped first, they write into the tracks
+    for (int i = 0; i < loudnessTrackCount; i++) free(loudnessTracks[i]);
+    free(loudnessTracks);
+    loudnessTracks = NULL;
+    loudnessTrackCount = loudnessTrackCapacity = 0;
+    loudnessPending = 0;
+}
@@ -0,0 +1,21 @@
+#ifndef LOUDNESS_H
+#define LOUDNESS_H
+
+#include "functions.h"
+
+// Integrated loudness (ITU-R BS.1770, LUFS) and true peak (dBTP, 4x oversampled)
+// of every stem are measured on the job workers and cached by path and mtime
+#define LOUDNESS_CACHE_FILE CACHE_FOLDER "/loudness.txt"
+#define DEFAULT_LOUDNESS_TARGET -18.0f
+#define LOUDNESS_PEAK_CEILING -1.0f     // normalization never pushes the true peak past this
+#define LOUDNESS_SILENCE -70.0f         // BS.1770 absolute gate, also what silent files measure as
+
+bool MeasureLoudness(const char *path, float *integrated, float *truePeak);
+
+// Applies cached results right away and queues the rest
+void StartLoudnessAnalysis(AppState *state);
+// Applies finished measurements and saves them to the cache
+void UpdateLoudnessAnalysis(AppState *state);
+void CloseLoudnessAnalysis(void);
+
+#endif
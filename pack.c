@@ -0,0 +1,158 @@
+#include "pack.h"
+#include "preload.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static const unsigned char *packData = NULL;
+static size_t packSize = 0;
+static const PackEntry *packEntries = NULL;
+static uint32_t packEntryCount = 0;
+static long packModTime = 0;
+static bool packMapped = false;     // false = read into memory
+
+static bool ValidateAssetPack(void) {
+    if (packSize < sizeof(PackHeader)) return false;
+    const PackHeader *header = (const PackHeader *)packData;
+    if (memcmp(header->magic, PACK_MAGIC, 4) != 0 || header->version != PACK_VERSION) return false;
+    if (header->entryCount > (packSize - sizeof(PackHeader))/sizeof(PackEntry)) return false;
+
+    packEntries = (const PackEntry *)(packData + sizeof(PackHeader));
+    packEntryCount = header->entryCount;
+    for (uint32_t i = 0; i < packEntryCount; i++) {
+        const PackEntry *entry = &packEntries[i];
+        if (memchr(entry->path, '\0', PACK_PATH_LENGTH) == NULL) return false;
+        if (entry->offset > packSize || entry->size > packSize - entry->offset || entry->size > INT32_MAX) return false;
+        if (i > 0 && strcmp(packEntries[i - 1].path, entry->path) >= 0) return false;
+    }
+    return true;
+}
+
+bool OpenAssetPack(const char *path) {
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0 || info.st_size == 0) {
+        if (fd >= 0) close(fd);
+        printf("Warning: could not open pack %s, reading loose files\n", path);
+        return false;
+    }
+
+    // The mapping outlives the descriptor, so the pack holds no file open
+    void *data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        printf("Warning: could not map pack %s, reading loose files\n", path);
+        return false;
+    }
+    packData = (const unsigned char *)data;
+    packSize = (size_t)info.st_size;
+    packMapped = true;
+#else
+    // No mapping without windows.h, which clashes with raylib; the pack is read whole
+    int size = 0;
+    packData = LoadFileData(path, &size);
+    packSize = (size_t)size;
+    packMapped = false;
+    if (packData == NULL) {
+        printf("Warning: could not open pack %s, reading loose files\n", path);
+        return false;
+    }
+#endif
+
+    if (!ValidateAssetPack()) {
+        printf("Warning: %s is not a valid pack, reading loose files\n", path);
+        CloseAssetPack();
+        return false;
+    }
+    packModTime = GetFileModTime(path);
+    printf("Opened pack %s: %u files, %.1f MB\n", path, packEntryCount, packSize/(1024.0*1024.0));
+    return true;
+}
+
+void CloseAssetPack(void) {
+    if (packData == NULL) return;
+#ifndef _WIN32
+    if (packMapped) munmap((void *)packData, packSize);
+#endif
+    if (!packMapped) UnloadFileData((unsigned char *)packData);
+    packData = NULL;
+    packSize = 0;
+    packEntries = NULL;
+    packEntryCount = 0;
+}
+
+static int ComparePackEntry(const void *key, const void *entry) {
+    return strcmp((const char *)key, ((const PackEntry *)entry)->path);
+}
+
+const unsigned char *FindPackedAsset(const char *path, int *size) {
+    if (packEntries == NULL) return NULL;
+    const PackEntry *entry = (const PackEntry *)bsearch(path, packEntries, packEntryCount, sizeof(PackEntry), ComparePackEntry);
+    if (entry == NULL) return NULL;
+    *size = (int)entry->size;
+    return packData + entry->offset;
+}
+
+bool IsAssetPacked(const char *path) {
+    int size;
+    return FindPackedAsset(path, &size) != NULL;
+}
+
+const unsigned char *FindAssetInMemory(const char *path, int *size) {
+    const unsigned char *data = FindPreloadedAsset(path, size);
+    return (data != NULL) ? data : FindPackedAsset(path, size);
+}
+
+Music LoadAssetMusic(const char *path) {
+    int size = 0;
+    const unsigned char *data = FindAssetInMemory(path, &size);
+    return (data != NULL) ? LoadMusicStreamFromMemory(GetFileExtension(path), data, size) : LoadMusicStream(path);
+}
+
+Wave LoadAssetWave(const char *path) {
+    int size = 0;
+    const unsigned char *data = FindAssetInMemory(path, &size);
+    return (data != NULL) ? LoadWaveFromMemory(GetFileExtension(path), data, size) : LoadWave(path);
+}
+
+Image LoadAssetImage(const char *path) {
+    int size = 0;
+    const unsigned char *data = FindPackedAsset(path, &size);
+    return (data != NULL) ? LoadImageFromMemory(GetFileExtension(path), data, size) : LoadImage(path);
+}
+
+void AdviseAssetReadAhead(const char *path) {
+    int size = 0;
+    if (FindPreloadedAsset(path, &size) != NULL) return;
+#ifndef _WIN32
+    // A packed file is a range of the mapping; madvise wants it page aligned
+    const unsigned char *packed = FindPackedAsset(path, &size);
+    if (packed != NULL) {
+#ifdef MADV_WILLNEED
+        uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+        uintptr_t start = (uintptr_t)packed & ~(page - 1);
+        if (packMapped && size > 0) madvise((void *)start, (uintptr_t)packed + size - start, MADV_WILLNEED);
+#endif
+        return;
+    }
+#ifdef POSIX_FADV_WILLNEED
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+#endif
+#endif
+}
+
+long GetAssetModTime(const char *path) {
+    return IsAssetPacked(path) ? packModTime : GetFileModTime(path);
+}
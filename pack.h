@@ -0,0 +1,32 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include "raylib.h"
+#include "packformat.h"
+#include <stdbool.h>
+
+// The pack is mapped read-only for the life of the player, and files in it are
+// decoded in place; anything not in it is read from disk as before. Lookups are
+// safe from job workers once the pack is open
+bool OpenAssetPack(const char *path);
+void CloseAssetPack(void);
+
+// NULL if there is no pack or the file is not in it
+const unsigned char *FindPackedAsset(const char *path, int *size);
+bool IsAssetPacked(const char *path);
+
+// Preloaded first, then packed; NULL = read from disk
+const unsigned char *FindAssetInMemory(const char *path, int *size);
+
+Music LoadAssetMusic(const char *path);
+Wave LoadAssetWave(const char *path);
+Image LoadAssetImage(const char *path);
+
+// Asks the kernel to start reading a file in, from the pack or from disk, so its
+// decoder does not block on it later. Can block itself, so it is for job workers
+void AdviseAssetReadAhead(const char *path);
+
+// The pack's own time for packed files, so caches keyed on it follow a rebuilt pack
+long GetAssetModTime(const char *path);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef PACKFORMAT_H
+#define PACKFORMAT_H
+
+#include <stdint.h>
+
+// One file holding every thumbnail and audio file data.json refers to:
+//   PackHeader
+//   PackEntry[entryCount], sorted by path (strcmp)
+//   blobs, each starting on a PACK_ALIGNMENT boundary
+// Fields are little-endian. Paths are spelled the way the player builds them,
+// base-folder/folder/file, so a packed file is found under the same name
+#define PACK_MAGIC "ULPK"
+#define PACK_VERSION 1
+#define PACK_ALIGNMENT 4096
+#define PACK_PATH_LENGTH 240
+
+typedef struct PackHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t reserved;
+} PackHeader;
+
+typedef struct PackEntry {
+    char path[PACK_PATH_LENGTH];    // NUL terminated
+    uint64_t offset;                // from the start of the pack
+    uint64_t size;
+} PackEntry;
+
+#endif
@@ -0,0 +1,203 @@
+// Builds a pack (see packformat.h) of every thumbnail and audio file data.json
+// refers to. Standalone, no raylib:
+//   cc packtool.c -o packtool
+//   ./packtool [data.json] [ultraplayer.pack]
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include "packformat.h"
+#include "./cjson/cJSON.c"
+
+typedef struct PackFile {
+    char path[PACK_PATH_LENGTH];
+    uint64_t size;
+} PackFile;
+
+static PackFile *files = NULL;
+static int fileCount = 0;
+static int fileCapacity = 0;
+
+static char *ReadText(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+    char *text = (char *)malloc(size + 1);
+    if (text != NULL) {
+        size_t read = fread(text, 1, size, file);
+        text[read] = '\0';
+    }
+    fclose(file);
+    return text;
+}
+
+// Same spelling as the player, so lookups match; duplicates are packed once
+static bool AddFile(const char *baseFolder, const char *folder, const char *name) {
+    char path[1024];
+    int length = snprintf(path, sizeof(path), "%s/%s/%s", baseFolder, folder, name);
+    if (length >= PACK_PATH_LENGTH) {
+        printf("Error: path too long for a pack (%d characters max): %s\n", PACK_PATH_LENGTH - 1, path);
+        return false;
+    }
+    for (int i = 0; i < fileCount; i++) {
+        if (strcmp(files[i].path, path) == 0) return true;
+    }
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        printf("Error: could not open %s\n", path);
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+
+    if (fileCount == fileCapacity) {
+        fileCapacity = fileCapacity ? fileCapacity*2 : 64;
+        files = (PackFile *)realloc(files, sizeof(PackFile)*fileCapacity);
+        if (files == NULL) return false;
+    }
+    PackFile *entry = &files[fileCount++];
+    memset(entry->path, 0, sizeof(entry->path));
+    memcpy(entry->path, path, length);
+    entry->size = (uint64_t)size;
+    return true;
+}
+
+// Mirrors what ParseJSONData reads: each level's thumbnail, and each segment's
+// "stems" files or its "free" and "combat" loops
+static bool CollectFiles(cJSON *root) {
+    cJSON *baseFolderItem = cJSON_GetObjectItemCaseSensitive(root, "base-folder");
+    cJSON *levelsObj = cJSON_GetObjectItemCaseSensitive(root, "levels");
+    if (!cJSON_IsString(baseFolderItem) || levelsObj == NULL) {
+        printf("Error: JSON missing base-folder or levels\n");
+        return false;
+    }
+    const char *baseFolder = baseFolderItem->valuestring;
+
+    bool ok = true;
+    cJSON *levelEntry = NULL;
+    cJSON_ArrayForEach(levelEntry, levelsObj) {
+        cJSON *folderItem = cJSON_GetObjectItemCaseSensitive(levelEntry, "folder");
+        cJSON *thumbItem = cJSON_GetObjectItemCaseSensitive(levelEntry, "thumbnail");
+        cJSON *segments = cJSON_GetObjectItemCaseSensitive(levelEntry, "segments");
+        if (!cJSON_IsString(folderItem) || !cJSON_IsString(thumbItem) || segments == NULL) continue;
+        const char *folder = folderItem->valuestring;
+        ok &= AddFile(baseFolder, folder, thumbItem->valuestring);
+
+        cJSON *segmentEntry = NULL;
+        cJSON_ArrayForEach(segmentEntry, segments) {
+            cJSON *stemsItem = cJSON_GetObjectItemCaseSensitive(segmentEntry, "stems");
+            cJSON *stemEntry = NULL;
+            cJSON_ArrayForEach(stemEntry, stemsItem) {
+                cJSON *fileItem = cJSON_GetObjectItemCaseSensitive(stemEntry, "file");
+                if (cJSON_IsString(fileItem)) ok &= AddFile(baseFolder, folder, fileItem->valuestring);
+            }
+            if (cJSON_IsArray(stemsItem)) continue;
+
+            cJSON *freeItem = cJSON_GetObjectItemCaseSensitive(segmentEntry, "free");
+            cJSON *combatItem = cJSON_GetObjectItemCaseSensitive(segmentEntry, "combat");
+            if (cJSON_IsString(freeItem)) ok &= AddFile(baseFolder, folder, freeItem->valuestring);
+            if (cJSON_IsString(combatItem)) ok &= AddFile(baseFolder, folder, combatItem->valuestring);
+        }
+    }
+    return ok;
+}
+
+static int ComparePackFile(const void *a, const void *b) {
+    return strcmp(((const PackFile *)a)->path, ((const PackFile *)b)->path);
+}
+
+static uint64_t AlignPackOffset(uint64_t offset) {
+    return (offset + PACK_ALIGNMENT - 1)/PACK_ALIGNMENT*PACK_ALIGNMENT;
+}
+
+static bool CopyFile(FILE *out, const char *path, uint64_t size) {
+    FILE *in = fopen(path, "rb");
+    if (in == NULL) return false;
+    char buffer[65536];
+    uint64_t copied = 0;
+    size_t read;
+    while (copied < size && (read = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        if (fwrite(buffer, 1, read, out) != read) break;
+        copied += read;
+    }
+    fclose(in);
+    return copied == size;
+}
+
+static bool WritePack(const char *path) {
+    // Written aside and renamed, so a player never maps a half-written pack
+    char tempPath[1024];
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", path);
+    FILE *out = fopen(tempPath, "wb");
+    if (out == NULL) {
+        printf("Error: could not write %s\n", tempPath);
+        return false;
+    }
+
+    PackHeader header = { { 0 }, PACK_VERSION, (uint32_t)fileCount, 0 };
+    memcpy(header.magic, PACK_MAGIC, 4);
+    PackEntry *entries = (PackEntry *)calloc(fileCount > 0 ? fileCount : 1, sizeof(PackEntry));
+    uint64_t offset = AlignPackOffset(sizeof(PackHeader) + sizeof(PackEntry)*(uint64_t)fileCount);
+    for (int i = 0; i < fileCount; i++) {
+        memcpy(entries[i].path, files[i].path, PACK_PATH_LENGTH);
+        entries[i].offset = offset;
+        entries[i].size = files[i].size;
+        offset = AlignPackOffset(offset + files[i].size);
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+              fwrite(entries, sizeof(PackEntry), fileCount, out) == (size_t)fileCount;
+    for (int i = 0; i < fileCount && ok; i++) {
+        static const char padding[PACK_ALIGNMENT] = { 0 };
+        long position = ftell(out);
+        ok = position >= 0 && fwrite(padding, 1, entries[i].offset - (uint64_t)position, out) == entries[i].offset - (uint64_t)position;
+        if (ok && !CopyFile(out, files[i].path, files[i].size)) {
+            printf("Error: could not read %s\n", files[i].path);
+            ok = false;
+        }
+    }
+    free(entries);
+    ok &= (fclose(out) == 0);
+
+#ifdef _WIN32
+    // rename does not replace an existing file here
+    if (ok) remove(path);
+#endif
+    if (!ok || rename(tempPath, path) != 0) {
+        printf("Error: could not write %s\n", path);
+        remove(tempPath);
+        return false;
+    }
+    printf("Packed %d files, %.1f MB, into %s\n", fileCount, offset/(1024.0*1024.0), path);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    const char *jsonPath = (argc > 1) ? argv[1] : "data.json";
+    const char *packPath = (argc > 2) ? argv[2] : "ultraplayer.pack";
+
+    char *text = ReadText(jsonPath);
+    if (text == NULL) {
+        printf("Error: Unable to open %s\n", jsonPath);
+        return 1;
+    }
+    cJSON *root = cJSON_Parse(text);
+    free(text);
+    if (root == NULL) {
+        printf("Error: Could not parse JSON\n");
+        return 1;
+    }
+
+    bool ok = CollectFiles(root);
+    cJSON_Delete(root);
+    if (!ok) return 1;
+
+    qsort(files, fileCount, sizeof(PackFile), ComparePackFile);
+    ok = WritePack(packPath);
+    free(files);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,208 @@
+#include "preload.h"
+#include "decoders.h"
+#include "jobs.h"
+#include "pack.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Reads kept in flight; more would only queue up in front of other background work
+#define PRELOAD_MAX_IN_FLIGHT 4
+
+typedef struct PreloadEntry {
+    char path[512];
+    unsigned char *data;
+    int size;                   // reserved against the budget before the read
+    _Atomic int status;         // PreloadStatus, the job sets it
+} PreloadEntry;
+
+static PreloadEntry *preloadEntries = NULL;    // catalog order, the order they are read in
+static PreloadEntry **preloadIndex = NULL;     // sorted by path for lookups
+static int preloadCount = 0;
+static int preloadSubmitted = 0;
+static _Atomic int preloadRunning = 0;          // submitted and not finished
+static size_t preloadBudget = 0;
+static _Atomic size_t preloadBytes = 0;
+static double preloadStart = 0.0;
+static bool preloadReported = false;
+static bool preloadReleasing = false;      // streams opened from disk are still open
+
+static int ComparePreloadIndex(const void *a, const void *b) {
+    return strcmp((*(PreloadEntry *const *)a)->path, (*(PreloadEntry *const *)b)->path);
+}
+
+static int FindPreloadIndex(const void *key, const void *entry) {
+    return strcmp((const char *)key, (*(PreloadEntry *const *)entry)->path);
+}
+
+// Size without reading the file: the pack index has it, otherwise the file system
+static int GetPreloadFileSize(const char *path) {
+    int size = 0;
+    if (FindPackedAsset(path, &size) != NULL) return size;
+    return FileExists(path) ? GetFileLength(path) : -1;
+}
+
+static unsigned char *ReadPreloadFile(const char *path, int *size) {
+    // Packed files are copied out of the mapping, which reads them off the disk once
+    const unsigned char *packed = FindPackedAsset(path, size);
+    if (packed != NULL) {
+        unsigned char *data = (unsigned char *)malloc(*size > 0 ? *size : 1);
+        if (data != NULL) memcpy(data, packed, *size);
+        return data;
+    }
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    rewind(file);
+    unsigned char *data = (length >= 0 && length <= INT32_MAX) ? (unsigned char *)malloc(length > 0 ? length : 1) : NULL;
+    if (data != NULL && fread(data, 1, length, file) != (size_t)length) {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    *size = (int)length;
+    return data;
+}
+
+static void PreloadJob(void *data) {
+    PreloadEntry *entry = (PreloadEntry *)data;
+    int size = 0;
+    entry->data = ReadPreloadFile(entry->path, &size);
+    int status = PRELOAD_READY;
+    if (entry->data == NULL || size != entry->size) {
+        // Missing, unreadable or changed since its size was reserved
+        atomic_fetch_sub(&preloadBytes, (size_t)entry->size);
+        free(entry->data);
+        entry->data = NULL;
+        status = PRELOAD_FAILED;
+    }
+    atomic_store_explicit(&entry->status, status, memory_order_release);
+    atomic_fetch_sub(&preloadRunning, 1);
+}
+
+void StartPreload(AppState *state) {
+    if (!state->preload) return;
+    preloadBudget = state->preloadBudget;
+    preloadStart = GetTime();
+
+    int capacity = 0;
+    for (int i = 0; i < state->levelCount; i++) {
+        for (int j = 0; j < state->levels[i].segmentCount; j++) capacity += state->levels[i].segments[j].stemCount;
+    }
+    preloadEntries = (PreloadEntry *)calloc(capacity > 0 ? capacity : 1, sizeof(PreloadEntry));
+    if (preloadEntries == NULL) return;
+
+    // Catalog order, so the first levels are the ones that fit when the budget runs out
+    for (int i = 0; i < state->levelCount; i++) {
+        Level *level = &state->levels[i];
+        if (!state->layers[level->layer].preload) continue;
+        for (int j = 0; j < level->segmentCount; j++) {
+            for (int k = 0; k < level->segments[j].stemCount; k++) {
+                const char *path = level->segments[j].stems[k].path;
+                bool duplicate = false;
+                for (int e = 0; e < preloadCount && !duplicate; e++) duplicate = (strcmp(preloadEntries[e].path, path) == 0);
+                if (!duplicate) snprintf(preloadEntries[preloadCount++].path, sizeof(preloadEntries[0].path), "%s", path);
+            }
+        }
+    }
+    preloadIndex = (PreloadEntry **)malloc(sizeof(PreloadEntry *)*(preloadCount > 0 ? preloadCount : 1));
+    if (preloadIndex == NULL) {
+        preloadCount = 0;
+        return;
+    }
+    for (int i = 0; i < preloadCount; i++) preloadIndex[i] = &preloadEntries[i];
+    qsort(preloadIndex, preloadCount, sizeof(PreloadEntry *), ComparePreloadIndex);
+
+    printf("Preloading %d audio files, up to %.0f MB\n", preloadCount, preloadBudget/(1024.0*1024.0));
+    UpdatePreload(state);
+}
+
+// Closes streams that were opened from disk before their file was read in. The
+// next play opens them from memory; a segment in use switches once it stops.
+// True while any such segment is left
+static bool ReleaseFileStreams(AppState *state) {
+    bool left = false;
+    for (int i = 0; i < state->levelCount; i++) {
+        Level *level = &state->levels[i];
+        for (int j = 0; j < level->segmentCount; j++) {
+            Segment *seg = &level->segments[j];
+            if (!seg->streamsLoaded) continue;
+            bool fromDisk = false;
+            for (int k = 0; k < seg->stemCount && !fromDisk; k++) {
+                int size;
+                const Stem *stem = &seg->stems[k];
+                fromDisk = stem->fileBacked && stem->resampledFile == NULL && FindPreloadedAsset(stem->path, &size) != NULL;
+            }
+            if (fromDisk && IsSegmentInUse(state, seg)) left = true;
+            else if (fromDisk) UnloadSegmentStreams(seg);
+        }
+    }
+    return left;
+}
+
+void UpdatePreload(AppState *state) {
+    if (preloadReleasing) preloadReleasing = ReleaseFileStreams(state);
+    if (preloadReported || preloadEntries == NULL) return;
+    while (preloadSubmitted < preloadCount && atomic_load(&preloadRunning) < PRELOAD_MAX_IN_FLIGHT) {
+        // Reserved here, in catalog order, so the budget goes to the first levels
+        // whichever read finishes first, and nothing is read only to be dropped
+        PreloadEntry *entry = &preloadEntries[preloadSubmitted];
+        int size = GetPreloadFileSize(entry->path);
+        if (size < 0 || atomic_load(&preloadBytes) + size > preloadBudget) {
+            atomic_store_explicit(&entry->status, (size < 0) ? PRELOAD_FAILED : PRELOAD_OVER_BUDGET, memory_order_release);
+            preloadSubmitted++;
+            continue;
+        }
+        entry->size = size;
+        atomic_fetch_add(&preloadBytes, (size_t)size);
+        atomic_fetch_add(&preloadRunning, 1);
+        if (!SubmitJob(PreloadJob, entry)) {
+            atomic_fetch_sub(&preloadRunning, 1);
+            atomic_fetch_sub(&preloadBytes, (size_t)size);
+            break;
+        }
+        preloadSubmitted++;
+    }
+    if (preloadSubmitted < preloadCount) return;
+
+    int counts[4] = { 0 };
+    for (int i = 0; i < preloadCount; i++) {
+        int status = atomic_load_explicit(&preloadEntries[i].status, memory_order_acquire);
+        if (status == PRELOAD_QUEUED) return;
+        counts[status]++;
+    }
+
+    preloadReported = true;
+    printf("Preloaded %d audio files, %.1f MB of %.0f MB, in %.2f s\n", counts[PRELOAD_READY],
+           atomic_load(&preloadBytes)/(1024.0*1024.0), preloadBudget/(1024.0*1024.0), GetTime() - preloadStart);
+    if (counts[PRELOAD_OVER_BUDGET] > 0) {
+        printf("Warning: %d files did not fit \"preload-budget-mb\" and stream from disk\n", counts[PRELOAD_OVER_BUDGET]);
+    }
+    if (counts[PRELOAD_FAILED] > 0) printf("Warning: %d files could not be preloaded\n", counts[PRELOAD_FAILED]);
+    RecordPreloadFootprint(atomic_load(&preloadBytes), counts[PRELOAD_READY], counts[PRELOAD_OVER_BUDGET] + counts[PRELOAD_FAILED]);
+    preloadReleasing = ReleaseFileStreams(state);
+}
+
+bool IsPreloadFinished(void) {
+    return preloadReported || preloadEntries == NULL;
+}
+
+const unsigned char *FindPreloadedAsset(const char *path, int *size) {
+    if (preloadIndex == NULL) return NULL;
+    PreloadEntry **found = (PreloadEntry **)bsearch(path, preloadIndex, preloadCount, sizeof(PreloadEntry *), FindPreloadIndex);
+    if (found == NULL || atomic_load_explicit(&(*found)->status, memory_order_acquire) != PRELOAD_READY) return NULL;
+    *size = (*found)->size;
+    return (*found)->data;
+}
+
+void ClosePreload(void) {
+    for (int i = 0; i < preloadCount; i++) free(preloadEntries[i].data);
+    free(preloadEntries);
+    free(preloadIndex);
+    preloadEntries = NULL;
+    preloadIndex = NULL;
+    preloadCount = 0;
+}
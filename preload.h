@@ -0,0 +1,35 @@
+#ifndef PRELOAD_H
+#define PRELOAD_H
+
+#include "functions.h"
+
+// With "preload", the compressed audio of the chosen layers is read into memory
+// on the job workers at startup and streams decode from there, so playback does
+// not wait on the disk. Files that would take the total past the budget are
+// left on disk
+#define PRELOAD_DEFAULT_BUDGET_MB 1024
+
+typedef enum {
+    PRELOAD_QUEUED = 0,
+    PRELOAD_READY,
+    PRELOAD_OVER_BUDGET,
+    PRELOAD_FAILED
+} PreloadStatus;
+
+// Queues every stem file of the layers marked for preloading
+void StartPreload(AppState *state);
+
+// Keeps a few reads in flight; once everything has landed, reports the
+// footprint and closes idle streams that were opened from disk
+void UpdatePreload(AppState *state);
+
+// True when there is nothing to preload or all of it has landed
+bool IsPreloadFinished(void);
+
+// NULL until the file has been read; safe from job workers
+const unsigned char *FindPreloadedAsset(const char *path, int *size);
+
+// Streams decoding from the buffers must be unloaded and job workers stopped first
+void ClosePreload(void);
+
+#endif
@@ -0,0 +1,214 @@
+#include "resample.h"
+#include "decoders.h"
+#include "jobs.h"
+#include "pack.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct ResampleEntry {
+    char path[512];
+    char file[512];             // converted copy in the cache
+    int sampleRate;
+    bool waiting;               // did not fit the job queue, UpdateResampling retries
+    bool urgent;                // submitted in front of the job queue
+    atomic_bool started;        // a promoted entry is queued twice, the second copy skips it
+    _Atomic int status;         // ResampleStatus, written by the worker
+} ResampleEntry;
+
+static ResampleEntry **resampleEntries = NULL;
+static int resampleCount = 0;
+static int resampleCapacity = 0;
+
+static void WriteLittleEndian(unsigned char *dst, unsigned int value, int bytes) {
+    for (int i = 0; i < bytes; i++) dst[i] = (unsigned char)(value >> (8*i));
+}
+
+unsigned char *ResampleMusicFile(const char *path, int sampleRate, int *wavSize) {
+    Wave wave = LoadAssetWave(path);
+    if (wave.data == NULL || wave.frameCount == 0) {
+        UnloadWave(wave);
+        return NULL;
+    }
+
+    DspResampler resampler;
+    if (!InitDspResampler(&resampler, (int)wave.sampleRate, sampleRate)) {
+        UnloadWave(wave);
+        return NULL;
+    }
+
+    double start = GetTime();
+    int channels = (int)wave.channels;
+    int inFrames = (int)wave.frameCount;
+    int outFrames = GetResampledFrames(&resampler, inFrames);
+    float *samples = (float *)malloc(sizeof(float)*inFrames*channels);
+    float *channel = (float *)calloc(inFrames + 2*DSP_RESAMPLER_TAPS, sizeof(float));
+    float *resampled = (float *)malloc(sizeof(float)*outFrames);
+    float *interleaved = (float *)malloc(sizeof(float)*outFrames*channels);
+    unsigned char *wav = (unsigned char *)malloc(44 + (size_t)outFrames*channels*sizeof(int16_t));
+
+    if (samples != NULL && channel != NULL && resampled != NULL && interleaved != NULL && wav != NULL) {
+        ReadWaveSamples(&wave, 0, samples, inFrames*channels);
+        for (int c = 0; c < channels; c++) {
+            float *in = channel + DSP_RESAMPLER_TAPS;
+            for (int i = 0; i < inFrames; i++) in[i] = samples[i*channels + c];
+            ResampleChannel(&resampler, resampled, in, inFrames);
+            for (int i = 0; i < outFrames; i++) interleaved[i*channels + c] = resampled[i];
+        }
+
+        unsigned int dataSize = (unsigned int)(outFrames*channels*sizeof(int16_t));
+        memcpy(wav, "RIFF", 4);
+        WriteLittleEndian(wav + 4, 36 + dataSize, 4);
+        memcpy(wav + 8, "WAVEfmt ", 8);
+        WriteLittleEndian(wav + 16, 16, 4);
+        WriteLittleEndian(wav + 20, 1, 2);                                  // PCM
+        WriteLittleEndian(wav + 22, channels, 2);
+        WriteLittleEndian(wav + 24, sampleRate, 4);
+        WriteLittleEndian(wav + 28, sampleRate*channels*sizeof(int16_t), 4);
+        WriteLittleEndian(wav + 32, channels*sizeof(int16_t), 2);
+        WriteLittleEndian(wav + 34, 16, 2);
+        memcpy(wav + 36, "data", 4);
+        WriteLittleEndian(wav + 40, dataSize, 4);
+        dsp.FloatToInt16((int16_t *)(wav + 44), interleaved, outFrames*channels);
+        *wavSize = (int)(44 + dataSize);
+
+        printf("Resampled %s from %u Hz to %d Hz in %.0f ms\n", path, wave.sampleRate, sampleRate,
+               (GetTime() - start)*1000.0);
+    } else {
+        free(wav);
+        wav = NULL;
+    }
+
+    free(interleaved);
+    free(resampled);
+    free(channel);
+    free(samples);
+    FreeDspResampler(&resampler);
+    UnloadWave(wave);
+    return wav;
+}
+
+// Written next to its final name and renamed, so a half-written file is never picked up
+static void ResampleJob(void *data) {
+    ResampleEntry *entry = (ResampleEntry *)data;
+    if (atomic_exchange(&entry->started, true)) return;
+    int size = 0;
+    unsigned char *wav = ResampleMusicFile(entry->path, entry->sampleRate, &size);
+    int status = RESAMPLE_FAILED;
+    if (wav != NULL) {
+        char temporary[520];
+        snprintf(temporary, sizeof(temporary), "%s.tmp", entry->file);
+        FILE *file = fopen(temporary, "wb");
+        bool written = file != NULL && fwrite(wav, 1, size, file) == (size_t)size;
+        if (file != NULL && fclose(file) != 0) written = false;
+        if (written && rename(temporary, entry->file) == 0) status = RESAMPLE_READY;
+        else remove(temporary);
+        free(wav);
+    }
+    if (status == RESAMPLE_FAILED) printf("Warning: could not resample %s, it may drift against the other stems\n", entry->path);
+    atomic_store_explicit(&entry->status, status, memory_order_release);
+}
+
+static void GetResampleCachePath(const char *path, int sampleRate, char *cachePath, int size) {
+    // FNV-1a over the path, then the mtime and rate, so an edited file converts again
+    uint64_t hash = 1469598103934665603ULL;
+    for (const unsigned char *c = (const unsigned char *)path; *c; c++) {
+        hash ^= *c;
+        hash *= 1099511628211ULL;
+    }
+    uint64_t salt[2] = { (uint64_t)GetAssetModTime(path), (uint64_t)sampleRate };
+    for (int i = 0; i < 2; i++) {
+        for (int b = 0; b < 8; b++) {
+            hash ^= (salt[i] >> (8*b)) & 0xFF;
+            hash *= 1099511628211ULL;
+        }
+    }
+    snprintf(cachePath, size, "%s/%016llx.wav", CACHE_FOLDER, (unsigned long long)hash);
+}
+
+static bool SubmitResampleJob(ResampleEntry *entry) {
+    return entry->urgent ? SubmitUrgentJob(ResampleJob, entry) : SubmitJob(ResampleJob, entry);
+}
+
+ResampleStatus GetResampledFile(const char *path, int sampleRate, bool urgent, const char **file) {
+    ResampleEntry *entry = NULL;
+    for (int i = 0; i < resampleCount && entry == NULL; i++) {
+        if (resampleEntries[i]->sampleRate == sampleRate && strcmp(resampleEntries[i]->path, path) == 0) entry = resampleEntries[i];
+    }
+
+    if (entry == NULL) {
+        if (resampleCount == resampleCapacity) {
+            int capacity = resampleCapacity ? resampleCapacity*2 : 16;
+            ResampleEntry **entries = (ResampleEntry **)realloc(resampleEntries, sizeof(ResampleEntry *)*capacity);
+            if (entries == NULL) return RESAMPLE_FAILED;
+            resampleEntries = entries;
+            resampleCapacity = capacity;
+        }
+        entry = (ResampleEntry *)calloc(1, sizeof(ResampleEntry));
+        if (entry == NULL) return RESAMPLE_FAILED;
+        snprintf(entry->path, sizeof(entry->path), "%s", path);
+        GetResampleCachePath(path, sampleRate, entry->file, sizeof(entry->file));
+        entry->sampleRate = sampleRate;
+        resampleEntries[resampleCount++] = entry;
+
+        if (FileExists(entry->file)) {
+            atomic_store(&entry->status, RESAMPLE_READY);
+        } else {
+            if (!DirectoryExists(CACHE_FOLDER)) MakeDirectory(CACHE_FOLDER);
+            atomic_store(&entry->status, RESAMPLE_QUEUED);
+            entry->urgent = urgent;
+            entry->waiting = !SubmitResampleJob(entry);
+        }
+    } else if (urgent && !entry->urgent && atomic_load(&entry->status) == RESAMPLE_QUEUED && !atomic_load(&entry->started)) {
+        // Behind up to a full queue of analysis and preloads; the copy already queued
+        // finds the job started when its turn comes
+        entry->urgent = true;
+        if (!entry->waiting) SubmitUrgentJob(ResampleJob, entry);
+    }
+
+    int status = atomic_load_explicit(&entry->status, memory_order_acquire);
+    if (status == RESAMPLE_READY) *file = entry->file;
+    return (ResampleStatus)status;
+}
+
+// True once no stem of the segment is waiting for its conversion
+static bool ResamplingLanded(const Segment *seg, bool urgent) {
+    unsigned int sampleRate = seg->stems[0].music.stream.sampleRate;
+    for (int i = 1; i < seg->stemCount; i++) {
+        const Stem *stem = &seg->stems[i];
+        if (stem->resampledFile != NULL || stem->music.stream.sampleRate == sampleRate) continue;
+        const char *file;
+        if (GetResampledFile(stem->path, (int)sampleRate, urgent, &file) == RESAMPLE_QUEUED) return false;
+    }
+    return true;
+}
+
+void UpdateResampling(AppState *state) {
+    for (int i = 0; i < resampleCount; i++) {
+        ResampleEntry *entry = resampleEntries[i];
+        if (entry->waiting) entry->waiting = !SubmitResampleJob(entry);
+    }
+
+    // A segment that is playing keeps its streams until it stops, and has its
+    // conversions moved up if it was opened before it was needed
+    for (int i = 0; i < state->levelCount; i++) {
+        for (int j = 0; j < state->levels[i].segmentCount; j++) {
+            Segment *seg = &state->levels[i].segments[j];
+            if (!seg->resamplePending || !seg->streamsLoaded) continue;
+            bool inUse = IsSegmentInUse(state, seg);
+            if (!ResamplingLanded(seg, inUse) || inUse) continue;
+            bool warm = seg->prefetched;
+            ReloadSegmentStreams(seg, false);
+            if (warm) RewarmSegment(seg);
+        }
+    }
+}
+
+void CloseResampling(void) {
+    for (int i = 0; i < resampleCount; i++) free(resampleEntries[i]);
+    free(resampleEntries);
+    resampleEntries = NULL;
+    resampleCount = resampleCapacity = 0;
+}
@@ -0,0 +1,32 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include "functions.h"
+
+// A stem whose rate differs from its segment's first stem is converted to that
+// rate on a job worker and cached as CACHE_FOLDER/<path, mtime and rate hash>.wav,
+// which it then streams from. Until the conversion lands it plays at its own rate
+typedef enum {
+    RESAMPLE_QUEUED,
+    RESAMPLE_READY,
+    RESAMPLE_FAILED
+} ResampleStatus;
+
+// Decodes the whole file, resamples every channel and wraps the result in a 16-bit
+// WAV in memory. Returns NULL on failure; the caller frees the buffer. Safe from job workers
+unsigned char *ResampleMusicFile(const char *path, int sampleRate, int *wavSize);
+
+// Sets file to the converted copy once it is in the cache; the first call for a
+// path and rate queues the conversion. urgent, for a segment that is in use, moves
+// a conversion that has not started in front of the job queue. The path stays
+// valid until CloseResampling
+ResampleStatus GetResampledFile(const char *path, int sampleRate, bool urgent, const char **file);
+
+// Resubmits conversions that did not fit the job queue, moves those of segments
+// now in use to its front, and reopens idle segments whose conversions have landed
+void UpdateResampling(AppState *state);
+
+// Job workers must be stopped and the streams unloaded first
+void CloseResampling(void);
+
+#endif
@@ -0,0 +1,337 @@
+#include "search.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct SearchEntry {
+    int level;
+    int segment;
+    int text;                   // offset of the normalized names in searchText
+} SearchEntry;
+
+// Gram key: length in the top byte, then up to three bytes
+typedef struct SearchGram {
+    uint32_t key;               // 0 = empty slot
+    int first;                  // postings of this gram, ascending entry ids
+    int count;
+    int lastEntry;              // while building, so an entry is only listed once
+} SearchGram;
+
+static SearchEntry *searchEntries = NULL;
+static int searchEntryCount = 0;
+static char *searchText = NULL;
+static SearchGram *searchGrams = NULL;
+static int searchGramCapacity = 0;          // power of two
+static int *searchPostings = NULL;
+
+// Matches of the last query, for refining as the user keeps typing
+static char lastQuery[SEARCH_QUERY_LENGTH] = { 0 };
+static int *searchMatches = NULL;
+static int searchMatchCount = 0;
+static bool searchAll = true;
+
+static int searchQueryCount = 0;
+static double searchTimeMax = 0.0;
+
+// Lowercase ASCII, anything else that isn't a letter or digit becomes one space.
+// Bytes of multi-byte characters are kept as they are
+static int NormalizeSearchText(char *dst, int size, const char *src, bool leadingSpace) {
+    int length = 0;
+    bool space = leadingSpace;
+    if (leadingSpace && size > 1) dst[length++] = ' ';
+    for (const unsigned char *c = (const unsigned char *)src; *c && length < size - 1; c++) {
+        unsigned char folded = (*c >= 'A' && *c <= 'Z') ? *c + ('a' - 'A') : *c;
+        bool word = (folded >= 'a' && folded <= 'z') || (folded >= '0' && folded <= '9') || folded >= 0x80;
+        if (word) {
+            dst[length++] = (char)folded;
+            space = false;
+        } else if (!space) {
+            dst[length++] = ' ';
+            space = true;
+        }
+    }
+    dst[length] = '\0';
+    return length;
+}
+
+static uint32_t MakeGramKey(const char *text, int length) {
+    uint32_t key = (uint32_t)length << 24;
+    for (int i = 0; i < length; i++) key |= (uint32_t)(unsigned char)text[i] << (8*(2 - i));
+    return key;
+}
+
+static SearchGram *FindGram(uint32_t key, bool insert) {
+    uint32_t slot = (key*2654435761u) & (searchGramCapacity - 1);
+    while (searchGrams[slot].key != 0) {
+        if (searchGrams[slot].key == key) return &searchGrams[slot];
+        slot = (slot + 1) & (searchGramCapacity - 1);
+    }
+    if (!insert) return NULL;
+    searchGrams[slot].key = key;
+    searchGrams[slot].lastEntry = -1;
+    return &searchGrams[slot];
+}
+
+// Counts every gram of an entry's text, or with fill lists the entry under it
+static void CountEntryGrams(int entry, bool fill) {
+    const char *text = searchText + searchEntries[entry].text;
+    int length = (int)strlen(text);
+    for (int i = 0; i < length; i++) {
+        for (int n = 1; n <= SEARCH_GRAM_MAX && i + n <= length; n++) {
+            SearchGram *gram = FindGram(MakeGramKey(text + i, n), !fill);
+            if (gram->lastEntry == entry) continue;
+            gram->lastEntry = entry;
+            if (fill) searchPostings[gram->first + gram->count] = entry;
+            gram->count++;
+        }
+    }
+}
+
+void BuildSearchIndex(AppState *state) {
+    double start = GetTime();
+    FreeSearchIndex();
+
+    int entryCount = 0;
+    for (int l = 0; l < state->levelCount; l++) entryCount += state->levels[l].segmentCount;
+    if (entryCount == 0) return;
+
+    // Names of every entry, one string each
+    int textCapacity = 0;
+    for (int l = 0; l < state->levelCount; l++) {
+        Level *level = &state->levels[l];
+        for (int s = 0; s < level->segmentCount; s++) {
+            Segment *seg = &level->segments[s];
+            textCapacity += (int)strlen(level->name) + (int)strlen(seg->name) + (int)strlen(state->layers[level->layer].name) + 4;
+            for (int i = 0; i < seg->stemCount; i++) textCapacity += (int)strlen(seg->stems[i].name) + 1;
+        }
+    }
+
+    searchEntries = (SearchEntry *)malloc(sizeof(SearchEntry)*entryCount);
+    searchText = (char *)malloc(textCapacity + 1);
+    searchMatches = (int *)malloc(sizeof(int)*entryCount);
+    if (searchEntries == NULL || searchText == NULL || searchMatches == NULL) {
+        printf("Error: Could not allocate the search index\n");
+        FreeSearchIndex();
+        return;
+    }
+
+    int textLength = 0;
+    for (int l = 0; l < state->levelCount; l++) {
+        Level *level = &state->levels[l];
+        for (int s = 0; s < level->segmentCount; s++) {
+            Segment *seg = &level->segments[s];
+            char names[2048];
+            int length = snprintf(names, sizeof(names), "%s %s %s", level->name, seg->name, state->layers[level->layer].name);
+            for (int i = 0; i < seg->stemCount && length < (int)sizeof(names); i++) {
+                length += snprintf(names + length, sizeof(names) - length, " %s", seg->stems[i].name);
+            }
+            searchEntries[searchEntryCount] = (SearchEntry){ l, s, textLength };
+            textLength += NormalizeSearchText(searchText + textLength, textCapacity + 1 - textLength, names, true) + 1;
+            searchEntryCount++;
+        }
+    }
+
+    // Count every gram, lay the postings out back to back, then fill them in
+    // entry order so each list comes out sorted
+    searchGramCapacity = 1024;
+    while (searchGramCapacity < textLength*2) searchGramCapacity *= 2;
+    searchGrams = (SearchGram *)calloc(searchGramCapacity, sizeof(SearchGram));
+    if (searchGrams == NULL) {
+        printf("Error: Could not allocate the search index\n");
+        FreeSearchIndex();
+        return;
+    }
+    for (int e = 0; e < searchEntryCount; e++) CountEntryGrams(e, false);
+
+    int postingCount = 0;
+    for (int g = 0; g < searchGramCapacity; g++) {
+        searchGrams[g].first = postingCount;
+        postingCount += searchGrams[g].count;
+        searchGrams[g].count = 0;
+        searchGrams[g].lastEntry = -1;
+    }
+    searchPostings = (int *)malloc(sizeof(int)*(postingCount > 0 ? postingCount : 1));
+    if (searchPostings == NULL) {
+        printf("Error: Could not allocate the search index\n");
+        FreeSearchIndex();
+        return;
+    }
+    for (int e = 0; e < searchEntryCount; e++) CountEntryGrams(e, true);
+
+    lastQuery[0] = '\0';
+    searchAll = true;
+    printf("Search index: %d entries, %d postings, built in %.1f ms\n",
+           searchEntryCount, postingCount, (GetTime() - start)*1000.0);
+}
+
+void FreeSearchIndex(void) {
+    if (searchQueryCount > 0) {
+        printf("Search: %d queries, %.3f ms max\n", searchQueryCount, searchTimeMax*1000.0);
+        searchQueryCount = 0;
+        searchTimeMax = 0.0;
+    }
+    free(searchEntries);
+    free(searchText);
+    free(searchGrams);
+    free(searchPostings);
+    free(searchMatches);
+    searchEntries = NULL;
+    searchText = NULL;
+    searchGrams = NULL;
+    searchPostings = NULL;
+    searchMatches = NULL;
+    searchEntryCount = searchGramCapacity = searchMatchCount = 0;
+}
+
+static bool EntryHasWords(int entry, char words[][SEARCH_QUERY_LENGTH], int wordCount) {
+    const char *text = searchText + searchEntries[entry].text;
+    for (int w = 0; w < wordCount; w++) {
+        if (strstr(text, words[w]) == NULL) return false;
+    }
+    return true;
+}
+
+// Keeps the candidates that may match and sets each level's first segment that
+// does. Once a level has one, the rest of its candidates are kept unchecked: the
+// grid only needs the first, and refining checks them again anyway
+static void FilterCandidates(AppState *state, const int *candidates, int count, char words[][SEARCH_QUERY_LENGTH],
+                             int wordCount, bool exact) {
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        int entry = candidates[i];
+        int level = searchEntries[entry].level;
+        if (state->searchSegment[level] < 0) {
+            if (!exact && !EntryHasWords(entry, words, wordCount)) continue;
+            state->searchSegment[level] = searchEntries[entry].segment;
+        }
+        searchMatches[kept++] = entry;
+    }
+    searchMatchCount = kept;
+}
+
+static void RunSearch(AppState *state) {
+    const char *query = state->searchQuery;
+    char normalized[SEARCH_QUERY_LENGTH];
+    NormalizeSearchText(normalized, sizeof(normalized), query, false);
+
+    // Words of the query; every one has to appear somewhere in the entry
+    char words[SEARCH_QUERY_LENGTH/2][SEARCH_QUERY_LENGTH];
+    int wordCount = 0;
+    for (char *word = strtok(normalized, " "); word != NULL; word = strtok(NULL, " ")) {
+        snprintf(words[wordCount++], SEARCH_QUERY_LENGTH, "%s", word);
+    }
+
+    bool refine = !searchAll && lastQuery[0] != '\0' && strncmp(query, lastQuery, strlen(lastQuery)) == 0;
+    snprintf(lastQuery, sizeof(lastQuery), "%s", query);
+    searchAll = (wordCount == 0);
+    for (int l = 0; l < state->levelCount; l++) state->searchSegment[l] = searchAll ? 0 : -1;
+    if (searchAll) return;
+
+    // Typing on: what matches now is among what matched before. Filtering in
+    // place is fine, it never writes ahead of where it reads
+    if (refine) {
+        FilterCandidates(state, searchMatches, searchMatchCount, words, wordCount, false);
+        return;
+    }
+
+    // Otherwise start from the shortest posting list of any gram in the query
+    const SearchGram *best = NULL;
+    bool exact = false;
+    for (int w = 0; w < wordCount; w++) {
+        int length = (int)strlen(words[w]);
+        int n = (length < SEARCH_GRAM_MAX) ? length : SEARCH_GRAM_MAX;
+        for (int i = 0; i + n <= length; i++) {
+            const SearchGram *gram = FindGram(MakeGramKey(words[w] + i, n), false);
+            if (gram == NULL) {
+                searchMatchCount = 0;
+                return;
+            }
+            if (best == NULL || gram->count < best->count) {
+                best = gram;
+                exact = (wordCount == 1 && length <= SEARCH_GRAM_MAX);
+            }
+        }
+    }
+
+    // A single short word is its own gram, so its list is the answer
+    FilterCandidates(state, searchPostings + best->first, best->count, words, wordCount, exact);
+}
+
+void ApplySearch(AppState *state) {
+    double start = GetTime();
+    if (searchEntries != NULL) {
+        RunSearch(state);
+    } else {
+        for (int l = 0; l < state->levelCount; l++) state->searchSegment[l] = 0;
+    }
+    state->visibleLevelCount = 0;
+    for (int l = 0; l < state->levelCount; l++) state->visibleLevelCount += (state->searchSegment[l] >= 0);
+
+    double elapsed = GetTime() - start;
+    searchQueryCount++;
+    if (elapsed > searchTimeMax) searchTimeMax = elapsed;
+}
+
+void UpdateSearchInput(AppState *state) {
+    if (!state->searchFocused) {
+        if (!IsKeyPressed(KEY_SLASH)) return;
+        state->searchFocused = true;
+        while (GetCharPressed() != 0) { }       // the slash itself
+        return;
+    }
+
+    int length = (int)strlen(state->searchQuery);
+    bool changed = false;
+    int key;
+    while ((key = GetCharPressed()) != 0) {
+        if (key < 32 || key > 126 || length >= SEARCH_QUERY_LENGTH - 1) continue;
+        state->searchQuery[length++] = (char)key;
+        state->searchQuery[length] = '\0';
+        changed = true;
+    }
+    if ((IsKeyPressed(KEY_BACKSPACE) || IsKeyPressedRepeat(KEY_BACKSPACE)) && length > 0) {
+        state->searchQuery[--length] = '\0';
+        changed = true;
+    }
+    if (IsKeyPressed(KEY_ESCAPE)) {
+        state->searchQuery[0] = '\0';
+        state->searchFocused = false;
+        changed = true;
+    }
+    if (IsKeyPressed(KEY_ENTER)) {
+        // The top match on screen: group by group, as the grid is drawn
+        state->searchFocused = false;
+        bool played = false;
+        for (int g = 0; g < state->layerCount && !played; g++) {
+            if (!IsLayerExpanded(state, g)) continue;
+            const LayerGroup *group = &state->layers[g];
+            for (int k = 0; k < group->levelCount && !played; k++) {
+                int l = group->levels[k];
+                if (state->searchSegment[l] < 0) continue;
+                PushPlaybackCommand(state, PLAYBACK_PLAY_LEVEL, l, state->searchSegment[l]);
+                played = true;
+            }
+        }
+    }
+
+    if (changed) {
+        ApplySearch(state);
+        state->scrollY = 0.0f;
+    }
+}
+
+void DrawSearchBar(AppState *state, int screenWidth) {
+    if (!state->searchFocused && state->searchQuery[0] == '\0') return;
+
+    DrawRectangle(0, 0, screenWidth, SEARCH_BAR_HEIGHT, DARKERRED);
+    char text[SEARCH_QUERY_LENGTH + 8];
+    bool caret = state->searchFocused && ((int)(GetTime()*2.0) & 1) == 0;
+    snprintf(text, sizeof(text), "/ %s%s", state->searchQuery, caret ? "_" : "");
+    DrawText(text, 10, (SEARCH_BAR_HEIGHT - FONT_SIZE_XLARGE)/2, FONT_SIZE_XLARGE, RAYWHITE);
+
+    char count[32];
+    snprintf(count, sizeof(count), "%d of %d", state->visibleLevelCount, state->levelCount);
+    DrawText(count, screenWidth - 10 - MeasureText(count, FONT_SIZE_MEDIUM), (SEARCH_BAR_HEIGHT - FONT_SIZE_MEDIUM)/2,
+             FONT_SIZE_MEDIUM, LIGHTGRAY);
+}
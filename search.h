@@ -0,0 +1,24 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include "functions.h"
+
+// Type-to-search over level, segment, layer group and stem names. Every segment is
+// one entry; its names are case-folded, punctuation becomes a single space, and
+// every 1-, 2- and 3-gram of the result points back at the entry
+#define SEARCH_GRAM_MAX 3
+
+// Rebuilt whenever the catalog changes
+void BuildSearchIndex(AppState *state);
+void FreeSearchIndex(void);
+
+// Refilters the grid for state->searchQuery. A query that extends the previous
+// one only rechecks the previous matches
+void ApplySearch(AppState *state);
+
+// "/" focuses the bar, typing filters per keystroke, Enter plays the first
+// match shown in the grid, Escape clears it
+void UpdateSearchInput(AppState *state);
+void DrawSearchBar(AppState *state, int screenWidth);
+
+#endif
@@ -0,0 +1,96 @@
+#include "session.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static double lastSessionSave = 0.0;
+
+// One "key value" pair per line; the level name guards against a data.json
+// that changed since the session was saved. Collapsed layer groups are restored
+// either way
+bool ResumeSession(AppState *state) {
+    FILE *file = fopen(SESSION_FILE, "r");
+    if (file == NULL) return false;
+
+    int levelIndex = -1, segmentIndex = 0, frame = 0, combat = 0, repeat = 0;
+    // As long as a line, so an overlong name fails the match rather than being cut
+    char line[512];
+    char name[sizeof(line)] = { 0 };
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (sscanf(line, "level %d", &levelIndex) == 1) continue;
+        if (sscanf(line, "segment %d", &segmentIndex) == 1) continue;
+        if (sscanf(line, "frame %d", &frame) == 1) continue;
+        if (sscanf(line, "combat %d", &combat) == 1) continue;
+        if (sscanf(line, "repeat %d", &repeat) == 1) continue;
+        if (strncmp(line, "name ", 5) == 0) snprintf(name, sizeof(name), "%s", line + 5);
+        if (strncmp(line, "collapsed ", 10) == 0) {
+            for (int i = 0; i < state->layerCount; i++) {
+                if (strcmp(state->layers[i].key, line + 10) == 0) state->layers[i].collapsed = true;
+            }
+        }
+    }
+    fclose(file);
+
+    if (levelIndex == -1) return false;
+    if (levelIndex < 0 || levelIndex >= state->levelCount || strcmp(state->levels[levelIndex].name, name) != 0) {
+        printf("Warning: %s does not match data.json, starting fresh\n", SESSION_FILE);
+        return false;
+    }
+    Level *level = &state->levels[levelIndex];
+    if (segmentIndex < 0 || segmentIndex >= level->segmentCount) segmentIndex = 0;
+
+    Segment *seg = &level->segments[segmentIndex];
+    if (!CheckOutSegmentStreams(state, seg) || seg->stems[0].music.ctxData == NULL) return false;
+
+    state->persistentCombat = combat != 0;
+    state->repeatSegment = repeat != 0;
+    SetCombatIntensity(state->persistentCombat ? 1.0f : 0.0f);
+
+    state->currentPlaying = levelIndex;
+    level->currentSegment = segmentIndex;
+    PlaySegmentFrom(state, seg, frame);
+    state->resumedSession = true;
+    lastSessionSave = GetTime();
+
+    printf("Resuming '%s' / '%s' at %.1f s\n", level->name, seg->name,
+           (float)frame/seg->stems[0].music.stream.sampleRate);
+    return true;
+}
+
+void SaveSession(AppState *state) {
+    lastSessionSave = GetTime();
+
+    // Written aside and renamed, so a crash mid-write keeps the previous session
+    if (!DirectoryExists(CACHE_FOLDER)) MakeDirectory(CACHE_FOLDER);
+    const char *tempPath = SESSION_FILE ".tmp";
+    FILE *file = fopen(tempPath, "w");
+    if (file == NULL) {
+        printf("Warning: could not write %s\n", tempPath);
+        return;
+    }
+    if (state->currentPlaying != -1) {
+        Level *level = &state->levels[state->currentPlaying];
+        Music master = level->segments[level->currentSegment].stems[0].music;
+        int frame = (int)(GetMusicTimePlayed(master)*master.stream.sampleRate);
+        fprintf(file, "level %d\nsegment %d\nframe %d\ncombat %d\nrepeat %d\nname %s\n",
+                state->currentPlaying, level->currentSegment, frame,
+                state->persistentCombat, state->repeatSegment, level->name);
+    }
+    for (int i = 0; i < state->layerCount; i++) {
+        if (state->layers[i].collapsed) fprintf(file, "collapsed %s\n", state->layers[i].key);
+    }
+    bool written = (fclose(file) == 0);
+#ifdef _WIN32
+    // rename does not replace an existing file here
+    remove(SESSION_FILE);
+#endif
+    if (!written || rename(tempPath, SESSION_FILE) != 0) {
+        printf("Warning: could not write %s\n", SESSION_FILE);
+        remove(tempPath);
+    }
+}
+
+void UpdateSession(AppState *state) {
+    if (GetTime() - lastSessionSave >= SESSION_SAVE_INTERVAL) SaveSession(state);
+}
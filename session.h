@@ -0,0 +1,18 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "functions.h"
+
+// What was playing, saved on exit and every SESSION_SAVE_INTERVAL seconds, so
+// the next launch can pick up where this one left off
+#define SESSION_FILE CACHE_FOLDER "/session.txt"
+#define SESSION_SAVE_INTERVAL 10.0
+
+// Opens only the saved segment and starts it at the saved frame. Call before the
+// background loader runs; false if there was nothing to resume
+bool ResumeSession(AppState *state);
+
+void UpdateSession(AppState *state);
+void SaveSession(AppState *state);
+
+#endif
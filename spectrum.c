@@ -0,0 +1,180 @@
+#include "spectrum.h"
+#include "audio.h"
+#include "dsp.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <time.h>
+
+#define SPECTRUM_FRESH 4        // set on the middle index when it holds an unread spectrum
+
+static DspFft spectrumFft;
+static float spectrumWindow[SPECTRUM_FFT_SIZE];
+static int bandFirstBin[SPECTRUM_BANDS];
+static int bandLastBin[SPECTRUM_BANDS];
+static unsigned int bandRate = 0;
+
+// Triple buffer: the thread owns back, the main loop owns front, middle is swapped
+static float spectrumBuffers[3][SPECTRUM_BANDS];
+static _Atomic int spectrumMiddle = 1;
+static int spectrumBack = 2;
+static int spectrumFront = 0;
+
+static _Atomic bool spectrumEnabled = false;
+static bool spectrumStopping = false;
+static bool spectrumThreadRunning = false;
+static pthread_t spectrumThread;
+static pthread_mutex_t spectrumLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t spectrumWake = PTHREAD_COND_INITIALIZER;
+
+// Log-spaced bands; the low ones share bins at this FFT size
+static void MapSpectrumBands(unsigned int rate) {
+    float maxHz = fminf(SPECTRUM_MAX_HZ, rate*0.5f);
+    float binHz = (float)rate/SPECTRUM_FFT_SIZE;
+    for (int b = 0; b < SPECTRUM_BANDS; b++) {
+        float low = SPECTRUM_MIN_HZ*powf(maxHz/SPECTRUM_MIN_HZ, (float)b/SPECTRUM_BANDS);
+        float high = SPECTRUM_MIN_HZ*powf(maxHz/SPECTRUM_MIN_HZ, (float)(b + 1)/SPECTRUM_BANDS);
+        bandFirstBin[b] = (int)(low/binHz + 0.5f);
+        bandLastBin[b] = (int)(high/binHz + 0.5f);
+        if (bandLastBin[b] <= bandFirstBin[b]) bandLastBin[b] = bandFirstBin[b] + 1;
+        if (bandLastBin[b] > SPECTRUM_FFT_SIZE/2) bandLastBin[b] = SPECTRUM_FFT_SIZE/2;
+    }
+    bandRate = rate;
+}
+
+static void AnalyseSpectrum(float *levels, float seconds) {
+    static float re[SPECTRUM_FFT_SIZE], im[SPECTRUM_FFT_SIZE];
+    if (!ReadOutputTap(re, SPECTRUM_FFT_SIZE)) return;
+
+    unsigned int rate = GetDeviceSampleRate();
+    if (rate != bandRate) MapSpectrumBands(rate);
+
+    for (int i = 0; i < SPECTRUM_FFT_SIZE; i++) {
+        re[i] *= spectrumWindow[i];
+        im[i] = 0.0f;
+    }
+    RunDspFft(&spectrumFft, re, im);
+
+    // A full-scale sine reads 0 dB: the Hann window sums to N/2, one-sided doubles it
+    const float scale = 4.0f/SPECTRUM_FFT_SIZE;
+    float fall = SPECTRUM_FALL_DB_PER_SECOND/-SPECTRUM_FLOOR_DB*seconds;
+    for (int b = 0; b < SPECTRUM_BANDS; b++) {
+        float power = 0.0f;
+        for (int k = bandFirstBin[b]; k < bandLastBin[b]; k++) {
+            power = fmaxf(power, re[k]*re[k] + im[k]*im[k]);
+        }
+        float db = 10.0f*log10f(power*scale*scale + 1e-12f);
+        float level = fminf(fmaxf(1.0f - db/SPECTRUM_FLOOR_DB, 0.0f), 1.0f);
+
+        // Rise at once, fall at a fixed rate so peaks stay readable
+        levels[b] = fmaxf(level, levels[b] - fall);
+    }
+}
+
+static void *SpectrumWorker(void *arg) {
+    (void)arg;
+    float levels[SPECTRUM_BANDS] = { 0 };
+    struct timespec last;
+    clock_gettime(CLOCK_MONOTONIC, &last);
+
+    pthread_mutex_lock(&spectrumLock);
+    while (!spectrumStopping) {
+        struct timespec wake;
+        clock_gettime(CLOCK_REALTIME, &wake);
+        wake.tv_nsec += 1000000000L/SPECTRUM_UPDATE_HZ;
+        if (wake.tv_nsec >= 1000000000L) {
+            wake.tv_sec++;
+            wake.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&spectrumWake, &spectrumLock, &wake);
+        if (spectrumStopping) break;
+        if (!atomic_load(&spectrumEnabled)) {
+            pthread_cond_wait(&spectrumWake, &spectrumLock);
+            clock_gettime(CLOCK_MONOTONIC, &last);
+            continue;
+        }
+        pthread_mutex_unlock(&spectrumLock);
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        float seconds = (float)(now.tv_sec - last.tv_sec) + (now.tv_nsec - last.tv_nsec)*1e-9f;
+        last = now;
+
+        AnalyseSpectrum(levels, seconds);
+        for (int b = 0; b < SPECTRUM_BANDS; b++) spectrumBuffers[spectrumBack][b] = levels[b];
+        spectrumBack = atomic_exchange_explicit(&spectrumMiddle, spectrumBack | SPECTRUM_FRESH, memory_order_acq_rel) & 3;
+
+        pthread_mutex_lock(&spectrumLock);
+    }
+    pthread_mutex_unlock(&spectrumLock);
+    return NULL;
+}
+
+static bool StartSpectrumThread(void) {
+    if (!InitDspFft(&spectrumFft, SPECTRUM_FFT_SIZE)) {
+        printf("Error: Could not set up the spectrum FFT\n");
+        return false;
+    }
+    for (int i = 0; i < SPECTRUM_FFT_SIZE; i++) {
+        spectrumWindow[i] = (float)(0.5 - 0.5*cos(2.0*DSP_PI*i/SPECTRUM_FFT_SIZE));
+    }
+
+    spectrumStopping = false;
+    if (pthread_create(&spectrumThread, NULL, SpectrumWorker, NULL) != 0) {
+        printf("Error: Could not start the spectrum thread\n");
+        FreeDspFft(&spectrumFft);
+        return false;
+    }
+    spectrumThreadRunning = true;
+    return true;
+}
+
+void SetSpectrumEnabled(bool enabled) {
+    if (enabled && !spectrumThreadRunning && !StartSpectrumThread()) return;
+
+    SetOutputTapEnabled(enabled);
+    atomic_store(&spectrumEnabled, enabled);
+    pthread_mutex_lock(&spectrumLock);
+    pthread_cond_signal(&spectrumWake);
+    pthread_mutex_unlock(&spectrumLock);
+}
+
+bool IsSpectrumEnabled(void) {
+    return atomic_load(&spectrumEnabled);
+}
+
+void DrawSpectrum(Rectangle bounds, Color color) {
+    static Vector2 points[4*SPECTRUM_BANDS];
+
+    if (atomic_load_explicit(&spectrumMiddle, memory_order_relaxed) & SPECTRUM_FRESH) {
+        spectrumFront = atomic_exchange_explicit(&spectrumMiddle, spectrumFront, memory_order_acq_rel) & 3;
+    }
+    const float *levels = spectrumBuffers[spectrumFront];
+
+    // Flat-topped bars joined by zero-width steps, so the strip stays one draw
+    float bottom = bounds.y + bounds.height;
+    float bandWidth = bounds.width/SPECTRUM_BANDS;
+    for (int b = 0; b < SPECTRUM_BANDS; b++) {
+        float top = bottom - fmaxf(levels[b]*bounds.height, 1.0f);
+        float left = bounds.x + b*bandWidth;
+        points[4*b] = (Vector2){ left, top };
+        points[4*b + 1] = (Vector2){ left, bottom };
+        points[4*b + 2] = (Vector2){ left + bandWidth, top };
+        points[4*b + 3] = (Vector2){ left + bandWidth, bottom };
+    }
+    DrawTriangleStrip(points, 4*SPECTRUM_BANDS, color);
+}
+
+void CloseSpectrum(void) {
+    if (!spectrumThreadRunning) return;
+
+    SetOutputTapEnabled(false);
+    pthread_mutex_lock(&spectrumLock);
+    spectrumStopping = true;
+    pthread_cond_signal(&spectrumWake);
+    pthread_mutex_unlock(&spectrumLock);
+    pthread_join(spectrumThread, NULL);
+    spectrumThreadRunning = false;
+    FreeDspFft(&spectrumFft);
+}
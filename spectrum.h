@@ -0,0 +1,27 @@
+#ifndef SPECTRUM_H
+#define SPECTRUM_H
+
+#include "raylib.h"
+#include <stdbool.h>
+
+// Spectrum of the mixed output. An analysis thread reads the audio tap, runs the
+// FFT and hands finished band levels to the main loop through a triple buffer,
+// so neither side ever waits on the other
+#define SPECTRUM_FFT_SIZE 2048
+#define SPECTRUM_BANDS 64
+#define SPECTRUM_MIN_HZ 40.0f
+#define SPECTRUM_MAX_HZ 16000.0f
+#define SPECTRUM_FLOOR_DB -72.0f
+#define SPECTRUM_FALL_DB_PER_SECOND 48.0f
+#define SPECTRUM_UPDATE_HZ 60
+
+// Starts the analysis thread on first use
+void SetSpectrumEnabled(bool enabled);
+bool IsSpectrumEnabled(void);
+
+// Latest finished spectrum as one triangle strip; cost depends on the band count only
+void DrawSpectrum(Rectangle bounds, Color color);
+
+void CloseSpectrum(void);
+
+#endif
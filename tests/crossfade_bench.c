@@ -0,0 +1,114 @@
+// Stream update cost of one segment against two overlapping ones, as during a
+// crossfade. Both segments' stems are decoded by raylib at the device's pace,
+// updated once per 60 Hz frame like the main loop does, and the time spent in
+// UpdateMusicStream is compared to the frame. Needs raylib and an audio device
+// (miniaudio's null device will do).
+//
+//   crossfade_bench a-free.ogg a-combat.ogg -- b-free.ogg b-combat.ogg
+#include "raylib.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_BENCH_STEMS 8
+#define BENCH_PHASE_SECONDS 5.0
+#define FRAME_SECONDS (1.0/60.0)
+#define UPDATE_BUDGET 0.25          // share of a frame two segments may spend decoding
+
+typedef struct BenchSegment {
+    Music stems[MAX_BENCH_STEMS];
+    int stemCount;
+} BenchSegment;
+
+static double NowSeconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec/1e9;
+}
+
+static void SleepSeconds(double seconds) {
+    if (seconds <= 0.0) return;
+    struct timespec delay = { (time_t)seconds, (long)((seconds - (time_t)seconds)*1e9) };
+    nanosleep(&delay, NULL);
+}
+
+static bool LoadBenchSegment(BenchSegment *seg, char **paths, int count) {
+    seg->stemCount = 0;
+    for (int i = 0; i < count && seg->stemCount < MAX_BENCH_STEMS; i++) {
+        Music music = LoadMusicStream(paths[i]);
+        if (music.ctxData == NULL) {
+            printf("Error: could not load %s\n", paths[i]);
+            return false;
+        }
+        music.looping = true;
+        seg->stems[seg->stemCount++] = music;
+    }
+    return seg->stemCount > 0;
+}
+
+// Mean and worst update time per frame, in seconds
+static void RunPhase(BenchSegment *segments, int segmentCount, double *mean, double *worst) {
+    double total = 0.0;
+    int frames = 0;
+    *worst = 0.0;
+    double end = NowSeconds() + BENCH_PHASE_SECONDS;
+    while (NowSeconds() < end) {
+        double start = NowSeconds();
+        for (int s = 0; s < segmentCount; s++) {
+            for (int i = 0; i < segments[s].stemCount; i++) UpdateMusicStream(segments[s].stems[i]);
+        }
+        double elapsed = NowSeconds() - start;
+        total += elapsed;
+        frames++;
+        if (elapsed > *worst) *worst = elapsed;
+        SleepSeconds(FRAME_SECONDS - elapsed);
+    }
+    *mean = total/frames;
+}
+
+int main(int argc, char **argv) {
+    int split = 0;
+    for (int i = 1; i < argc && split == 0; i++) {
+        if (strcmp(argv[i], "--") == 0) split = i;
+    }
+    if (split <= 1 || split >= argc - 1) {
+        printf("usage: %s <stems of segment a> -- <stems of segment b>\n", argv[0]);
+        return 2;
+    }
+
+    SetTraceLogLevel(LOG_WARNING);
+    InitAudioDevice();
+    if (!IsAudioDeviceReady()) {
+        printf("Error: no audio device\n");
+        return 1;
+    }
+
+    BenchSegment segments[2];
+    if (!LoadBenchSegment(&segments[0], argv + 1, split - 1) || !LoadBenchSegment(&segments[1], argv + split + 1, argc - split - 1)) {
+        CloseAudioDevice();
+        return 1;
+    }
+
+    double mean[2], worst[2];
+    for (int i = 0; i < segments[0].stemCount; i++) PlayMusicStream(segments[0].stems[i]);
+    RunPhase(segments, 1, &mean[0], &worst[0]);
+    for (int i = 0; i < segments[1].stemCount; i++) PlayMusicStream(segments[1].stems[i]);
+    RunPhase(segments, 2, &mean[1], &worst[1]);
+
+    const char *labels[2] = { "one segment ", "crossfading " };
+    for (int i = 0; i < 2; i++) {
+        printf("%s: %.3f ms mean, %.3f ms worst per frame, %.1f%% of a frame\n", labels[i],
+               mean[i]*1000.0, worst[i]*1000.0, mean[i]/FRAME_SECONDS*100.0);
+    }
+
+    for (int s = 0; s < 2; s++) {
+        for (int i = 0; i < segments[s].stemCount; i++) UnloadMusicStream(segments[s].stems[i]);
+    }
+    CloseAudioDevice();
+
+    if (mean[1] > UPDATE_BUDGET*FRAME_SECONDS) {
+        printf("FAIL: crossfading takes more than %.0f%% of a frame\n", UPDATE_BUDGET*100.0);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,112 @@
+// Throughput of every sample kernel under each kernel set this CPU can run, in
+// M samples/s over blocks the size of a large device callback.
+#include "../dsp.c"
+#include <time.h>
+
+#define BENCH_BLOCK 4096
+#define BENCH_SECONDS 0.25
+#define BENCH_MIX_INPUTS 4
+#define MAX_KERNEL_SETS 4
+
+enum {
+    KERNEL_FLOAT_TO_INT16,
+    KERNEL_INT16_TO_FLOAT,
+    KERNEL_GAIN_RAMP,
+    KERNEL_MIX_INPUTS,
+    KERNEL_CLAMP_SAMPLES,
+    KERNEL_SOFT_CLIP,
+    KERNEL_DOT_PRODUCT,
+    KERNEL_BUTTERFLIES,
+    KERNEL_COUNT
+};
+
+static const char *kernelNames[KERNEL_COUNT] = {
+    "FloatToInt16", "Int16ToFloat", "GainRamp", "MixInputs", "ClampSamples", "SoftClip", "DotProduct", "Butterflies"
+};
+
+static float input[BENCH_MIX_INPUTS][BENCH_BLOCK];
+static float output[BENCH_BLOCK], outputIm[BENCH_BLOCK];
+static float zeroTwiddles[BENCH_BLOCK/2];
+static int16_t pcm[BENCH_BLOCK];
+static volatile float sink;
+
+static double NowSeconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec/1e9;
+}
+
+// Every pass leaves the data in range, so repeated passes never reach denormals
+// or infinities; zero twiddles keep the butterflies from doubling it each pass
+static void RunKernel(const DspKernels *kernels, int kernel) {
+    static const float gains[BENCH_MIX_INPUTS] = { 0.7f, 0.45f, 0.3f, 0.2f };
+    const float *inputs[BENCH_MIX_INPUTS] = { input[0], input[1], input[2], input[3] };
+    switch (kernel) {
+        case KERNEL_FLOAT_TO_INT16: kernels->FloatToInt16(pcm, input[0], BENCH_BLOCK); break;
+        case KERNEL_INT16_TO_FLOAT: kernels->Int16ToFloat(output, pcm, BENCH_BLOCK); break;
+        case KERNEL_GAIN_RAMP: kernels->GainRamp(output, BENCH_BLOCK/2, 2, 1.0f, 1.0f); break;
+        case KERNEL_MIX_INPUTS: kernels->MixInputs(output, inputs, gains, BENCH_MIX_INPUTS, BENCH_BLOCK); break;
+        case KERNEL_CLAMP_SAMPLES: kernels->ClampSamples(output, BENCH_BLOCK, 1.0f); break;
+        case KERNEL_SOFT_CLIP: kernels->SoftClip(output, BENCH_BLOCK); break;
+        case KERNEL_DOT_PRODUCT: sink = kernels->DotProduct(input[0], input[1], BENCH_BLOCK); break;
+        case KERNEL_BUTTERFLIES: kernels->Butterflies(output, outputIm, zeroTwiddles, zeroTwiddles, BENCH_BLOCK/2); break;
+    }
+}
+
+static double BenchKernel(const DspKernels *kernels, int kernel) {
+    memcpy(output, input[0], sizeof(output));
+    memcpy(outputIm, input[1], sizeof(outputIm));
+    kernels->FloatToInt16(pcm, input[0], BENCH_BLOCK);
+
+    long long passes = 0;
+    double start = NowSeconds(), elapsed = 0.0;
+    while (elapsed < BENCH_SECONDS) {
+        for (int i = 0; i < 64; i++) RunKernel(kernels, kernel);
+        passes += 64;
+        elapsed = NowSeconds() - start;
+    }
+    return passes*BENCH_BLOCK/elapsed/1e6;
+}
+
+int main(void) {
+    const DspKernels *sets[MAX_KERNEL_SETS];
+    int setCount = 0;
+    sets[setCount++] = &scalarKernels;
+#if defined(DSP_X86)
+    sets[setCount++] = &sse2Kernels;
+#if defined(DSP_AVX2)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) sets[setCount++] = &avx2Kernels;
+    else printf("avx2: not supported by this CPU, skipped\n");
+#endif
+#elif defined(DSP_NEON)
+    sets[setCount++] = &neonKernels;
+#endif
+
+    unsigned int seed = 12345;
+    for (int k = 0; k < BENCH_MIX_INPUTS; k++) {
+        for (int i = 0; i < BENCH_BLOCK; i++) {
+            seed = seed*1103515245u + 12345u;
+            input[k][i] = ((seed >> 8) & 0xFFFF)/21845.0f - 1.5f;   // -1.5..1.5
+        }
+    }
+
+    printf("%-14s", "M samples/s");
+    for (int s = 0; s < setCount; s++) printf(s == 0 ? "%10s" : "%17s", sets[s]->name);
+    printf("\n");
+    for (int kernel = 0; kernel < KERNEL_COUNT; kernel++) {
+        printf("%-14s", kernelNames[kernel]);
+        double scalar = 0.0;
+        for (int s = 0; s < setCount; s++) {
+            double rate = BenchKernel(sets[s], kernel);
+            if (s == 0) {
+                scalar = rate;
+                printf("%10.0f", rate);
+            } else {
+                printf("%10.0f (%4.1fx)", rate, rate/scalar);
+            }
+        }
+        printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,130 @@
+// Bit-exactness of the vector kernels against the scalar reference.
+// Built against dsp.c directly, so it needs neither raylib nor an audio device.
+#include "../dsp.c"
+
+#define MAX_COUNT 4099
+
+static float input[2][MAX_COUNT + 8];
+static float expected[MAX_COUNT + 8], actual[MAX_COUNT + 8];
+static float expectedIm[MAX_COUNT + 8], actualIm[MAX_COUNT + 8];
+static int16_t expectedPcm[MAX_COUNT + 8], actualPcm[MAX_COUNT + 8];
+static int16_t pcm[MAX_COUNT + 8];
+static int failures = 0;
+
+static void Fail(const DspKernels *kernels, const char *kernel, int count, int offset) {
+    printf("FAIL: %s %s, count %d, offset %d\n", kernels->name, kernel, count, offset);
+    failures++;
+}
+
+static void FillInput(unsigned int seed) {
+    for (int k = 0; k < 2; k++) {
+        for (int i = 0; i < MAX_COUNT + 8; i++) {
+            seed = seed*1103515245u + 12345u;
+            input[k][i] = ((seed >> 8) & 0xFFFF)/16384.0f - 2.0f;   // -2..2
+        }
+    }
+    // Rounding ties, full scale and the soft clip knee
+    const float edges[] = { 0.5f/32768.0f, -0.5f/32768.0f, 1.5f/32768.0f, -2.5f/32768.0f, 1.0f, -1.0f,
+                            32767.0f/32768.0f, DSP_SOFT_CLIP_KNEE, -DSP_SOFT_CLIP_KNEE, 0.0f, -0.0f };
+    for (int i = 0; i < (int)(sizeof(edges)/sizeof(edges[0])); i++) input[0][i*7] = edges[i];
+
+    // Random PCM, with both extremes
+    for (int i = 0; i < MAX_COUNT + 8; i++) {
+        seed = seed*1103515245u + 12345u;
+        pcm[i] = (int16_t)(seed >> 16);
+    }
+    pcm[0] = INT16_MIN;
+    pcm[1] = INT16_MAX;
+}
+
+// offset shifts every buffer, so unaligned loads and stores are exercised too
+static void CheckKernels(const DspKernels *kernels, int count, int offset) {
+    const float *a = input[0] + offset, *b = input[1] + offset;
+
+    scalarKernels.FloatToInt16(expectedPcm + offset, a, count);
+    kernels->FloatToInt16(actualPcm + offset, a, count);
+    if (memcmp(expectedPcm + offset, actualPcm + offset, count*sizeof(int16_t)) != 0) Fail(kernels, "FloatToInt16", count, offset);
+
+    scalarKernels.Int16ToFloat(expected + offset, pcm + offset, count);
+    kernels->Int16ToFloat(actual + offset, pcm + offset, count);
+    if (memcmp(expected + offset, actual + offset, count*sizeof(float)) != 0) Fail(kernels, "Int16ToFloat", count, offset);
+
+    for (int channels = 1; channels <= 2; channels++) {
+        int frames = count/channels;
+        memcpy(expected + offset, a, count*sizeof(float));
+        memcpy(actual + offset, a, count*sizeof(float));
+        scalarKernels.GainRamp(expected + offset, frames, channels, 0.25f, 0.9f);
+        kernels->GainRamp(actual + offset, frames, channels, 0.25f, 0.9f);
+        if (memcmp(expected + offset, actual + offset, count*sizeof(float)) != 0) Fail(kernels, "GainRamp", count, offset);
+    }
+
+    // In place over the first input, as the mixer sums into its output
+    const float gains[3] = { 1.0f, 0.7f, 0.45f };
+    memcpy(expected + offset, a, count*sizeof(float));
+    memcpy(actual + offset, a, count*sizeof(float));
+    const float *expectedInputs[3] = { expected + offset, a, b };
+    const float *actualInputs[3] = { actual + offset, a, b };
+    scalarKernels.MixInputs(expected + offset, expectedInputs, gains, 3, count);
+    kernels->MixInputs(actual + offset, actualInputs, gains, 3, count);
+    if (memcmp(expected + offset, actual + offset, count*sizeof(float)) != 0) Fail(kernels, "MixInputs", count, offset);
+
+    memcpy(expected + offset, a, count*sizeof(float));
+    memcpy(actual + offset, a, count*sizeof(float));
+    scalarKernels.ClampSamples(expected + offset, count, 1.0f);
+    kernels->ClampSamples(actual + offset, count, 1.0f);
+    if (memcmp(expected + offset, actual + offset, count*sizeof(float)) != 0) Fail(kernels, "ClampSamples", count, offset);
+
+    memcpy(expected + offset, a, count*sizeof(float));
+    memcpy(actual + offset, a, count*sizeof(float));
+    scalarKernels.SoftClip(expected + offset, count);
+    kernels->SoftClip(actual + offset, count);
+    if (memcmp(expected + offset, actual + offset, count*sizeof(float)) != 0) Fail(kernels, "SoftClip", count, offset);
+
+    int dotCount = count & ~7;
+    float expectedDot = scalarKernels.DotProduct(a, b, dotCount);
+    float actualDot = kernels->DotProduct(a, b, dotCount);
+    if (memcmp(&expectedDot, &actualDot, sizeof(float)) != 0) Fail(kernels, "DotProduct", count, offset);
+
+    // Data in the first half of each array, twiddles in the second
+    int half = count/2;
+    memcpy(expected + offset, a, count*sizeof(float));
+    memcpy(actual + offset, a, count*sizeof(float));
+    memcpy(expectedIm + offset, b, count*sizeof(float));
+    memcpy(actualIm + offset, b, count*sizeof(float));
+    scalarKernels.Butterflies(expected + offset, expectedIm + offset, a + half, b + half, half/2);
+    kernels->Butterflies(actual + offset, actualIm + offset, a + half, b + half, half/2);
+    if (memcmp(expected + offset, actual + offset, count*sizeof(float)) != 0 ||
+        memcmp(expectedIm + offset, actualIm + offset, count*sizeof(float)) != 0) Fail(kernels, "Butterflies", count, offset);
+}
+
+static void CheckKernelSet(const DspKernels *kernels) {
+    for (unsigned int seed = 1; seed <= 4; seed++) {
+        FillInput(seed);
+        for (int offset = 0; offset < 4; offset++) {
+            for (int count = 0; count <= 300; count++) CheckKernels(kernels, count, offset);
+            CheckKernels(kernels, 1037, offset);
+            CheckKernels(kernels, MAX_COUNT, offset);
+        }
+    }
+    printf("%s: checked\n", kernels->name);
+}
+
+int main(void) {
+#if defined(DSP_X86)
+    CheckKernelSet(&sse2Kernels);
+#if defined(DSP_AVX2)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) CheckKernelSet(&avx2Kernels);
+    else printf("avx2: not supported by this CPU, skipped\n");
+#endif
+#elif defined(DSP_NEON)
+    CheckKernelSet(&neonKernels);
+#else
+    printf("No vector kernels on this target\n");
+#endif
+    if (failures > 0) {
+        printf("%d mismatches\n", failures);
+        return 1;
+    }
+    return 0;
+}
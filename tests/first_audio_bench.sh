@@ -0,0 +1,31 @@
+#!/bin/sh
+# Time to first audio on a warm start: runs the player several times from a
+# saved session and reports what it measured. Run it from the folder with
+# data.json, after playing something once so cache/session.txt exists.
+#
+#   tests/first_audio_bench.sh ./ultraplayer [runs]
+
+player=${1:?usage: first_audio_bench.sh <player> [runs]}
+runs=${2:-10}
+
+if [ ! -f cache/session.txt ]; then
+    echo "Error: no cache/session.txt here, play something and quit first" >&2
+    exit 1
+fi
+
+# The player quits once the resumed segment is heard, saving the session for the next run
+times=""
+for run in $(seq "$runs"); do
+    seconds=$(ULTRAPLAYER_EXIT_AFTER_FIRST_AUDIO=1 "$player" 2>&1 | sed -n 's/^First audio \([0-9.]*\) s after startup$/\1/p')
+    if [ -z "$seconds" ]; then
+        echo "Error: run $run did not report first audio" >&2
+        exit 1
+    fi
+    echo "run $run: $seconds s"
+    times="$times$seconds
+"
+done
+
+printf "%s" "$times" | sort -n | awk '{ t[NR] = $1 } END {
+    printf "warm start, %d runs: min %.3f s, median %.3f s, max %.3f s\n", NR, t[1], t[int((NR + 1)/2)], t[NR]
+}'
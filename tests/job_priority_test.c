@@ -0,0 +1,104 @@
+// Job queue priority, as read-ahead hints depend on it: with the workers busy on
+// slow reads and a backlog queued behind them, an urgent job has to run within a
+// switch's lead time. The reads are simulated by a hook that sleeps, as a cold
+// disk or a network mount would. The hint itself is a stand-in; whether streams
+// underrun needs raylib and an audio device, which these tests do without.
+#include "../jobs.c"
+#include <stdatomic.h>
+#include <time.h>
+
+#define TEST_WORKERS 2
+#define BACKLOG_JOBS 40
+#define SLOW_READ_MS 20
+#define SWITCH_DEADLINE_MS 100      // a beat at 150 bpm, less than a bar
+
+static void (*readHook)(void) = NULL;
+static _Atomic int finishedJobs = 0;
+static _Atomic int hintPosition = -1;           // how many jobs finished before it
+static _Atomic long long hintFinishedNs = 0;
+
+static long long NowNs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec*1000000000LL + now.tv_nsec;
+}
+
+static void SlowRead(void) {
+    struct timespec delay = { 0, SLOW_READ_MS*1000000L };
+    nanosleep(&delay, NULL);
+}
+
+// Stands in for preload and loudness reads
+static void BacklogJob(void *data) {
+    (void)data;
+    if (readHook != NULL) readHook();
+    atomic_fetch_add(&finishedJobs, 1);
+}
+
+// Stands in for the read-ahead hint, which only touches the page cache
+static void HintJob(void *data) {
+    (void)data;
+    atomic_store(&hintPosition, atomic_fetch_add(&finishedJobs, 1));
+    atomic_store(&hintFinishedNs, NowNs());
+}
+
+// Holds the only worker while the queue is filled
+static _Atomic bool blocking = false;
+
+static void BlockingJob(void *data) {
+    (void)data;
+    atomic_store(&blocking, true);
+    while (atomic_load(&blocking)) SlowRead();
+}
+
+// Queues the backlog, then the hint, and returns how long the hint took in ms
+static double RunHint(bool urgent, int *position) {
+    atomic_store(&finishedJobs, 0);
+    atomic_store(&hintPosition, -1);
+    if (!InitJobSystem(TEST_WORKERS)) return -1.0;
+    for (int i = 0; i < BACKLOG_JOBS; i++) SubmitJob(BacklogJob, NULL);
+
+    long long submitted = NowNs();
+    bool queued = urgent ? SubmitUrgentJob(HintJob, NULL) : SubmitJob(HintJob, NULL);
+    while (queued && atomic_load(&hintPosition) < 0) SlowRead();
+    CloseJobSystem();
+
+    *position = atomic_load(&hintPosition);
+    return queued ? (atomic_load(&hintFinishedNs) - submitted)/1e6 : -1.0;
+}
+
+int main(void) {
+    int failures = 0;
+    readHook = SlowRead;
+
+    int position;
+    double ms = RunHint(true, &position);
+    printf("urgent hint: %.1f ms, after %d of %d backlog jobs\n", ms, position, BACKLOG_JOBS);
+    if (ms < 0.0 || ms > SWITCH_DEADLINE_MS || position > TEST_WORKERS) {
+        printf("FAIL: the hint did not land before the switch\n");
+        failures++;
+    }
+
+    // The same hint through the plain queue, to show the backlog is long enough to matter
+    ms = RunHint(false, &position);
+    printf("queued hint: %.1f ms, after %d of %d backlog jobs\n", ms, position, BACKLOG_JOBS);
+    if (ms <= SWITCH_DEADLINE_MS) {
+        printf("FAIL: the backlog is too short to delay a queued hint\n");
+        failures++;
+    }
+
+    // A full queue refuses hints too; UpdateReadAhead retries them on the next frame
+    readHook = NULL;
+    InitJobSystem(1);
+    SubmitJob(BlockingJob, NULL);
+    while (!atomic_load(&blocking)) SlowRead();
+    for (int i = 0; i < MAX_QUEUED_JOBS; i++) SubmitJob(BacklogJob, NULL);
+    if (SubmitUrgentJob(HintJob, NULL)) {
+        printf("FAIL: a full queue accepted a hint\n");
+        failures++;
+    }
+    atomic_store(&blocking, false);
+    CloseJobSystem();
+
+    return failures > 0;
+}
@@ -0,0 +1,96 @@
+// Seek cost in a long stem, the way SeekSegment moves each stem: stop it to drop
+// its buffers, seek, and decode the first buffer from the new position. Positions
+// are spread over the whole file and visited out of order, so every seek jumps
+// far, and the worst one is compared to a stream buffer. Needs raylib and an audio
+// device (miniaudio's null device will do).
+//
+//   seek_bench long-free.ogg [more stems...]
+#include "raylib.h"
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_BUFFER_FRAMES 4096
+#define SEEK_POSITIONS 64
+#define SEEK_STEP 23                // coprime with SEEK_POSITIONS, so each position is visited once
+#define SEEK_ROUNDS 4
+
+static double NowSeconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec/1e9;
+}
+
+// Worst seek in seconds; mean over the first and last quarter of the file, to show
+// whether the cost grows with the distance into it
+static double BenchFile(const char *path, double *mean, double *meanStart, double *meanEnd, float *length, double *buffer) {
+    Music music = LoadMusicStream(path);
+    if (music.ctxData == NULL || music.stream.sampleRate == 0 || music.frameCount == 0) {
+        printf("Error: could not load %s\n", path);
+        if (music.ctxData != NULL) UnloadMusicStream(music);
+        return -1.0;
+    }
+    *length = (float)music.frameCount/music.stream.sampleRate;
+    *buffer = (double)BENCH_BUFFER_FRAMES/music.stream.sampleRate;
+
+    double worst = 0.0, total = 0.0, quarter[2] = { 0.0, 0.0 };
+    int quarterCount[2] = { 0, 0 };
+    for (int round = 0; round < SEEK_ROUNDS; round++) {
+        for (int i = 0; i < SEEK_POSITIONS; i++) {
+            int slot = (i*SEEK_STEP) % SEEK_POSITIONS;
+            float position = *length*slot/SEEK_POSITIONS;
+            double start = NowSeconds();
+            StopMusicStream(music);
+            SeekMusicStream(music, position);
+            UpdateMusicStream(music);
+            double elapsed = NowSeconds() - start;
+
+            total += elapsed;
+            if (elapsed > worst) worst = elapsed;
+            int q = (slot < SEEK_POSITIONS/4) ? 0 : (slot >= SEEK_POSITIONS*3/4) ? 1 : -1;
+            if (q >= 0) {
+                quarter[q] += elapsed;
+                quarterCount[q]++;
+            }
+        }
+    }
+    *mean = total/(SEEK_ROUNDS*SEEK_POSITIONS);
+    *meanStart = quarter[0]/quarterCount[0];
+    *meanEnd = quarter[1]/quarterCount[1];
+    UnloadMusicStream(music);
+    return worst;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("usage: %s <stem> [stem...]\n", argv[0]);
+        return 2;
+    }
+
+    SetTraceLogLevel(LOG_WARNING);
+    InitAudioDevice();
+    if (!IsAudioDeviceReady()) {
+        printf("Error: no audio device\n");
+        return 1;
+    }
+    SetAudioStreamBufferSizeDefault(BENCH_BUFFER_FRAMES);
+
+    int failures = 0;
+    for (int i = 1; i < argc; i++) {
+        double mean, meanStart, meanEnd, buffer;
+        float length;
+        double worst = BenchFile(argv[i], &mean, &meanStart, &meanEnd, &length, &buffer);
+        if (worst < 0.0) {
+            failures++;
+            continue;
+        }
+        printf("%s (%.0f s): %.2f ms mean, %.2f ms first quarter, %.2f ms last quarter, %.2f ms worst (buffer %.1f ms)\n",
+               argv[i], length, mean*1000.0, meanStart*1000.0, meanEnd*1000.0, worst*1000.0, buffer*1000.0);
+        if (worst > buffer) {
+            printf("FAIL: a seek in %s takes longer than one buffer\n", argv[i]);
+            failures++;
+        }
+    }
+
+    CloseAudioDevice();
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,135 @@
+#include "thumbnails.h"
+#include "jobs.h"
+#include "pack.h"
+#include <stdatomic.h>
+#include <stdio.h>
+
+static unsigned int thumbnailFrame = 1;
+static size_t thumbnailBytes = 0;
+static int thumbnailEvictions = 0;
+static int thumbnailUploads = 0;
+
+// Completion slots: the worker only sees its slot, the main loop hands the
+// image to the level once the status says it landed
+typedef struct ThumbnailSlot {
+    char path[512];
+    Level *level;               // main thread only, NULL = free
+    Image image;
+    _Atomic int status;         // ThumbnailStatus, the decode job sets DECODED or FAILED
+} ThumbnailSlot;
+
+static ThumbnailSlot thumbnailSlots[THUMBNAIL_MAX_DECODES];
+
+static void ThumbnailJob(void *data) {
+    ThumbnailSlot *slot = (ThumbnailSlot *)data;
+    slot->image = LoadAssetImage(slot->path);
+    int status = (slot->image.data != NULL) ? THUMBNAIL_DECODED : THUMBNAIL_FAILED;
+    atomic_store_explicit(&slot->status, status, memory_order_release);
+}
+
+void RequestThumbnail(Level *level, bool visible) {
+    // Near the viewport counts as in use, or eviction and prefetch would fight
+    level->thumbnailUsed = thumbnailFrame;
+    if (level->thumbnailStatus != THUMBNAIL_NONE) return;
+
+    ThumbnailSlot *slot = NULL;
+    int freeSlots = 0;
+    for (int i = 0; i < THUMBNAIL_MAX_DECODES; i++) {
+        if (thumbnailSlots[i].level != NULL) continue;
+        if (slot == NULL) slot = &thumbnailSlots[i];
+        freeSlots++;
+    }
+    // Prefetches leave slots for the tiles on screen, which retry every frame
+    if (slot == NULL || (!visible && freeSlots <= THUMBNAIL_MAX_DECODES/2)) return;
+
+    snprintf(slot->path, sizeof(slot->path), "%s", level->thumbnailPath);
+    slot->image = (Image){ 0 };
+    atomic_store_explicit(&slot->status, THUMBNAIL_QUEUED, memory_order_relaxed);
+    // Short and on screen, so ahead of analysis and preload work
+    if (!SubmitUrgentJob(ThumbnailJob, slot)) return;
+    slot->level = level;
+    level->thumbnailStatus = THUMBNAIL_QUEUED;
+}
+
+bool UseThumbnail(Level *level) {
+    level->thumbnailUsed = thumbnailFrame;
+    return level->thumbnailStatus == THUMBNAIL_READY;
+}
+
+void UnloadLevelThumbnail(Level *level) {
+    // A decode in flight is dropped when it lands, see UpdateThumbnails
+    int status = level->thumbnailStatus;
+    if (status == THUMBNAIL_READY) {
+        thumbnailBytes -= GetPixelDataSize(level->thumbnail.width, level->thumbnail.height, level->thumbnail.format);
+        UnloadTexture(level->thumbnail);
+        level->thumbnail = (Texture2D){ 0 };
+    } else if (status == THUMBNAIL_DECODED) {
+        UnloadImage(level->thumbnailImage);
+    } else {
+        return;
+    }
+    level->thumbnailImage = (Image){ 0 };
+    level->thumbnailStatus = THUMBNAIL_NONE;
+}
+
+void UpdateThumbnails(AppState *state) {
+    for (int i = 0; i < THUMBNAIL_MAX_DECODES; i++) {
+        ThumbnailSlot *slot = &thumbnailSlots[i];
+        if (slot->level == NULL) continue;
+        int status = atomic_load_explicit(&slot->status, memory_order_acquire);
+        if (status == THUMBNAIL_QUEUED) continue;
+
+        slot->level->thumbnailImage = slot->image;
+        slot->level->thumbnailStatus = status;
+        slot->image = (Image){ 0 };
+        slot->level = NULL;
+    }
+
+    int uploads = 0;
+    for (int i = 0; i < state->levelCount; i++) {
+        Level *level = &state->levels[i];
+        if (level->thumbnailStatus != THUMBNAIL_DECODED) continue;
+
+        // Its group was collapsed while it decoded
+        if (state->layers[level->layer].collapsed) {
+            UnloadLevelThumbnail(level);
+            continue;
+        }
+        if (uploads >= THUMBNAIL_UPLOADS_PER_FRAME) continue;
+
+        level->thumbnail = LoadTextureFromImage(level->thumbnailImage);
+        UnloadImage(level->thumbnailImage);
+        level->thumbnailImage = (Image){ 0 };
+        thumbnailBytes += GetPixelDataSize(level->thumbnail.width, level->thumbnail.height, level->thumbnail.format);
+        level->thumbnailStatus = THUMBNAIL_READY;
+        uploads++;
+        thumbnailUploads++;
+    }
+
+    // Least recently used first, never one drawn or requested this frame
+    while (thumbnailBytes > state->thumbnailBudget) {
+        Level *oldest = NULL;
+        for (int i = 0; i < state->levelCount; i++) {
+            Level *level = &state->levels[i];
+            if (level->thumbnailStatus != THUMBNAIL_READY) continue;
+            if (level->thumbnailUsed >= thumbnailFrame) continue;
+            if (oldest == NULL || level->thumbnailUsed < oldest->thumbnailUsed) oldest = level;
+        }
+        if (oldest == NULL) break;
+        UnloadLevelThumbnail(oldest);
+        thumbnailEvictions++;
+    }
+    thumbnailFrame++;
+}
+
+void CloseThumbnails(AppState *state) {
+    printf("Thumbnails: %d uploads, %d evictions, %.1f MB resident\n",
+           thumbnailUploads, thumbnailEvictions, thumbnailBytes/(1024.0*1024.0));
+    for (int i = 0; i < state->levelCount; i++) UnloadLevelThumbnail(&state->levels[i]);
+    // Decodes that landed after the last update; dropped jobs never filled their slot
+    for (int i = 0; i < THUMBNAIL_MAX_DECODES; i++) {
+        ThumbnailSlot *slot = &thumbnailSlots[i];
+        if (slot->level != NULL && atomic_load(&slot->status) == THUMBNAIL_DECODED) UnloadImage(slot->image);
+        slot->level = NULL;
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef THUMBNAILS_H
+#define THUMBNAILS_H
+
+#include "functions.h"
+
+// Level thumbnails are decoded on a job worker when their tile comes near the
+// viewport, uploaded by the main loop a few per frame, and evicted least
+// recently drawn first once the textures pass the budget
+#define THUMBNAIL_DEFAULT_BUDGET_MB 64
+#define THUMBNAIL_UPLOADS_PER_FRAME 4
+#define THUMBNAIL_LOOKAHEAD 0.5f        // seconds of scrolling to prefetch ahead
+#define THUMBNAIL_MAX_DECODES 8         // in flight; prefetches may take half, visible tiles the rest
+
+typedef enum {
+    THUMBNAIL_NONE = 0,
+    THUMBNAIL_QUEUED,           // a decode slot is working on it
+    THUMBNAIL_DECODED,          // image waiting for upload
+    THUMBNAIL_READY,
+    THUMBNAIL_FAILED
+} ThumbnailStatus;
+
+// Queues the decode if nothing is loaded or on the way, for tiles near the viewport.
+// Visible tiles go ahead of prefetches and of background work
+void RequestThumbnail(Level *level, bool visible);
+
+// Marks the thumbnail as drawn this frame; true once the texture is there
+bool UseThumbnail(Level *level);
+
+void UnloadLevelThumbnail(Level *level);
+
+// Collects finished decodes and uploads a few, then evicts until the textures fit the budget
+void UpdateThumbnails(AppState *state);
+
+// Job workers must be stopped first
+void CloseThumbnails(AppState *state);
+
+#endif
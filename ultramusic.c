@@ -6,7 +6,33 @@
 #include <math.h>
 #include "./cjson/cJSON.h"
 #include "functions.h"
+#include "jobs.h"
+#include "loudness.h"
+#include "waveform.h"
+#include "spectrum.h"
+#include "session.h"
+#include "search.h"
+#include "thumbnails.h"
+#include "decoders.h"
+#include "pack.h"
+#include "preload.h"
+#include "resample.h"
+#include "dsp.c"
+#include "audio.c"
 #include "functions.c"
+#include "control.h"
+#include "control.c"
+#include "jobs.c"
+#include "loudness.c"
+#include "waveform.c"
+#include "spectrum.c"
+#include "session.c"
+#include "search.c"
+#include "thumbnails.c"
+#include "decoders.c"
+#include "pack.c"
+#include "preload.c"
+#include "resample.c"
 
 int main(void) {
     const int screenWidth = 900;
@@ -14,25 +40,42 @@ int main(void) {
     SetConfigFlags(FLAG_MSAA_4X_HINT);
     SetConfigFlags(FLAG_WINDOW_ALWAYS_RUN);
     InitWindow(screenWidth, screenHeight, "ultraplayer");
+    InitDspKernels();
     InitAudioDevice();
+    InitAudioClock();
     SetTargetFPS(60);
 
-    AppState state = {0};
+    // Tens of megabytes of catalog, far too big for the main thread's stack
+    static AppState state = {0};
     state.currentPlaying = -1;
+    state.hoverLevel = -1;
     InitializeButtons(&state, screenWidth, screenHeight);
     
-    BeginDrawing();
-        DrawText("Loading assets...", 10, 10, 20, WHITE);
-    EndDrawing();
-    
-    
-    // Load levels
-    if (!ParseJSONData("data.json", state.levels, &state.levelCount)) {
+    // Load levels; only metadata here, assets follow in the background
+    if (!ParseJSONData("data.json", &state)) {
+        FreeLevels(&state);
+        CloseAudioClock();
         CloseAudioDevice();
         CloseWindow();
         return 1;
     }
 
+    if (state.packPath[0] != '\0') OpenAssetPack(state.packPath);
+    InitDecoderPool(&state);
+    BuildSearchIndex(&state);
+    ApplySearch(&state);
+
+    // The saved segment goes first so audio starts before the catalog is loaded
+    ResumeSession(&state);
+
+    InitJobSystem(0);
+    StartPreload(&state);
+    StartLoudnessAnalysis(&state);
+    if (state.visualizer) SetSpectrumEnabled(true);
+
+    if (state.controlSocketPath[0] != '\0') InitControlSocket(state.controlSocketPath);
+    if (state.sharedMemoryName[0] != '\0') InitSharedIntensity(state.sharedMemoryName);
+
     // Level buttons layout
     const int buttonWidth = 150;
     const int buttonHeight = 150;
@@ -40,73 +83,47 @@ int main(void) {
     state.buttonsPerRow = screenWidth / (buttonWidth + padding);
     state.startX = (screenWidth - (state.buttonsPerRow * (buttonWidth + padding) - padding)) / 2;
 
-    while (!WindowShouldClose()) {
+    // For tests/first_audio_bench.sh: quit as soon as the first audio is heard
+    bool exitAfterFirstAudio = getenv("ULTRAPLAYER_EXIT_AFTER_FIRST_AUDIO") != NULL;
+
+    while (!WindowShouldClose() && !(exitAfterFirstAudio && state.firstAudioReported)) {
         Vector2 mousePoint = GetMousePosition();
+        UpdateAudioClock();
+        PollControlSocket(&state);
+        PollSharedIntensity(&state);
+        UpdateLoudnessAnalysis(&state);
+        UpdateSession(&state);
+        UpdateSearchInput(&state);
         
-        if (state.currentPlaying != -1) {
-            // Check for music end and handle repeat/continue
-            HandleMusicEnd(&state);
-            
-            // Add keyboard controls after mousePoint definition
+        // Check for music end and handle repeat/continue, even while typing
+        HandleMusicEnd(&state);
+
+        // Typing into the search bar is not a shortcut
+        if (state.currentPlaying != -1 && !state.searchFocused) {
             Level *currentLevel = &state.levels[state.currentPlaying];
             Segment *currentSeg = &currentLevel->segments[currentLevel->currentSegment];
             
             // Space to toggle pause
-            if (IsKeyPressed(KEY_SPACE)) {
-                state.isPaused = !state.isPaused;
-                HandleMusicPause(&state);
-            }
+            if (IsKeyPressed(KEY_SPACE)) PushPlaybackCommand(&state, PLAYBACK_TOGGLE_PAUSE, 0, 0);
             
             // C to toggle combat music
-            if (IsKeyPressed(KEY_C) && currentSeg->hasCombat) {
-                state.persistentCombat = !state.persistentCombat;
-                SetMusicVolume(currentSeg->free, state.persistentCombat ? 0.0f : 1.0f);
-                SetMusicVolume(currentSeg->combat, state.persistentCombat ? 1.0f : 0.0f);
-            }
+            if (IsKeyPressed(KEY_C) && currentSeg->hasCombat) PushPlaybackCommand(&state, PLAYBACK_TOGGLE_COMBAT, 0, 0);
 
             // Right arrow - next segment/level
-            if (IsKeyPressed(KEY_RIGHT)) {
-                bool levelChanged = false;
-                GetNextSegment(&state, currentLevel, &levelChanged);
-                
-                if (levelChanged) {
-                    HandleMusicTransition(&state, currentLevel, 
-                                       &state.levels[state.currentPlaying], 0);
-                } else if (currentLevel->currentSegment < currentLevel->segmentCount) {
-                    HandleMusicTransition(&state, currentLevel, 
-                                       currentLevel, currentLevel->currentSegment);
-                }
-            }
+            if (IsKeyPressed(KEY_RIGHT)) PushPlaybackCommand(&state, PLAYBACK_NEXT, 0, 0);
             
             // Left arrow - previous segment/level
-            if (IsKeyPressed(KEY_LEFT)) {
-                if (currentLevel->currentSegment > 0) {
-                    // Previous segment in current level
-                    HandleMusicTransition(&state, currentLevel, 
-                                       currentLevel, currentLevel->currentSegment - 1);
-                } else if (state.currentPlaying > 0) {
-                    // Last segment of previous level
-                    Level *prevLevel = &state.levels[state.currentPlaying - 1];
-                    state.currentPlaying--;
-                    HandleMusicTransition(&state, currentLevel, 
-                                       prevLevel, prevLevel->segmentCount - 1);
-                }
-            }
+            if (IsKeyPressed(KEY_LEFT)) PushPlaybackCommand(&state, PLAYBACK_PREVIOUS, 0, 0);
 
-            // Add to keyboard input section where other key checks are
-            if (IsKeyPressed(KEY_R)) {
-                state.repeatSegment = !state.repeatSegment;
-                state.repeatBtn.color = state.repeatSegment ? RED : GRAY;
-            }
+            // R to toggle repeat
+            if (IsKeyPressed(KEY_R)) PushPlaybackCommand(&state, PLAYBACK_TOGGLE_REPEAT, 0, 0);
         }
 
-        if (state.currentPlaying != -1) {
-            Segment *currentSeg = &state.levels[state.currentPlaying].segments[state.levels[state.currentPlaying].currentSegment];
-            UpdateMusicStream(currentSeg->free);
-            if (currentSeg->hasCombat) {
-                UpdateMusicStream(currentSeg->combat);
-            }
-        }
+        // V to toggle the spectrum panel
+        if (IsKeyPressed(KEY_V) && !state.searchFocused) SetSpectrumEnabled(!IsSpectrumEnabled());
+
+        UpdateSegmentStreams(&state);
+
         // Update button states
         state.pauseBtn.isHovered = IsButtonHovered(state.pauseBtn, mousePoint);
         state.combatBtn.isHovered = IsButtonHovered(state.combatBtn, mousePoint);
@@ -115,18 +132,12 @@ int main(void) {
 
         // Handle pause button
         if (IsButtonClicked(state.pauseBtn, mousePoint)) {
-            state.isPaused = !state.isPaused;
-            HandleMusicPause(&state);
+            PushPlaybackCommand(&state, PLAYBACK_TOGGLE_PAUSE, 0, 0);
         }
 
         // Handle combat button
         if (IsButtonClicked(state.combatBtn, mousePoint) && state.currentPlaying != -1) {
-            state.persistentCombat = !state.persistentCombat;
-            Segment *currentSeg = &state.levels[state.currentPlaying].segments[state.levels[state.currentPlaying].currentSegment];
-            if (currentSeg->hasCombat) {
-                SetMusicVolume(currentSeg->free, state.persistentCombat ? 0.0f : 1.0f);
-                SetMusicVolume(currentSeg->combat, state.persistentCombat ? 1.0f : 0.0f);
-            }
+            PushPlaybackCommand(&state, PLAYBACK_TOGGLE_COMBAT, 0, 0);
         }
 
         // Handle segment button
@@ -136,20 +147,40 @@ int main(void) {
 
         // Handle repeat button
         if (IsButtonClicked(state.repeatBtn, mousePoint)) {
-            state.repeatSegment = !state.repeatSegment;
-            state.repeatBtn.color = state.repeatSegment ? RED : GRAY;
+            PushPlaybackCommand(&state, PLAYBACK_TOGGLE_REPEAT, 0, 0);
+        }
+
+        // Click or drag on the progress bar to seek; the streams move on release
+        if (state.currentPlaying != -1) {
+            Rectangle seekArea = { state.progressBar.x, state.progressBar.y - 6, state.progressBar.width, state.progressBar.height + 12 };
+            if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT) && !state.showSegmentMenu && CheckCollisionPointRec(mousePoint, seekArea)) {
+                state.draggingProgress = true;
+            }
+            if (state.draggingProgress) {
+                state.dragProgress = Clamp((mousePoint.x - state.progressBar.x)/state.progressBar.width, 0.0f, 1.0f);
+                if (IsMouseButtonReleased(MOUSE_BUTTON_LEFT)) {
+                    Segment *currentSeg = &state.levels[state.currentPlaying].segments[state.levels[state.currentPlaying].currentSegment];
+                    PushPlaybackCommand(&state, PLAYBACK_SEEK, (int)(state.dragProgress*currentSeg->stems[0].music.frameCount), 0);
+                    state.draggingProgress = false;
+                }
+            }
+        } else {
+            state.draggingProgress = false;
         }
 
         // Handle scrolling
         float wheelMove = GetMouseWheelMove();
+        float previousScroll = state.scrollY;
         if (wheelMove != 0) {
             state.scrollY += wheelMove * SCROLL_SPEED;
-            int totalRows = (state.levelCount + state.buttonsPerRow - 1) / state.buttonsPerRow;
-            float minScroll = -(totalRows * (buttonHeight + padding) - (screenHeight - CONTROL_PANEL_HEIGHT));
+            float minScroll = -(state.contentHeight - (screenHeight - CONTROL_PANEL_HEIGHT));
             if (minScroll > 0) minScroll = 0;
             
             state.scrollY = Clamp(state.scrollY, minScroll, 0.0f);
         }
+        if (GetFrameTime() > 0.0f) {
+            state.scrollVelocity = Lerp(state.scrollVelocity, (state.scrollY - previousScroll)/GetFrameTime(), 0.2f);
+        }
 
         // After updating button states and before drawing
         // Update pause button color to reflect state
@@ -159,50 +190,94 @@ int main(void) {
         BeginDrawing();
         ClearBackground(DARKERRED);
 
-        // Draw level buttons
-        for (int i = 0; i < state.levelCount; i++) {
-            int row = i / state.buttonsPerRow;
-            int col = i % state.buttonsPerRow;
-            float x = state.startX + col * (buttonWidth + padding);
-            float y = padding + row * (buttonHeight + padding) + state.scrollY;
-
-            // Create image button
-            Button levelBtn = CreateImageButton(
-                (Rectangle){x, y, buttonWidth, buttonHeight},
-                state.levels[i].thumbnail,
-                fminf((buttonWidth - 20) / (float)state.levels[i].thumbnail.width, 
-                     (buttonHeight - 40) / (float)state.levels[i].thumbnail.height),
-                state.levels[i].name,
-                (i == state.currentPlaying) ? RED : DARKRED,
-                MIDRED, LIGHTGRAY,
-                GetFontDefault(),
-                10, 1.0f, true,
-                (Rectangle){x + padding/2, y + buttonHeight - 30, buttonWidth - padding, 30}
-            );
-
-            levelBtn.isHovered = IsButtonHovered(levelBtn, mousePoint);
-            if (IsButtonClicked(levelBtn, mousePoint) && 
-                !state.showSegmentMenu &&
-                mousePoint.y < (screenHeight - CONTROL_PANEL_HEIGHT)) {
-                if (state.currentPlaying != -1) {
-                    Segment *oldSeg = &state.levels[state.currentPlaying].segments[state.levels[state.currentPlaying].currentSegment];
-                    StopMusicStream(oldSeg->free);
-                    if (oldSeg->hasCombat) StopMusicStream(oldSeg->combat);
+        // Draw level buttons group by group, leaving out the ones the search filtered
+        // away. While searching, matches in collapsed groups are shown too
+        bool searching = state.searchQuery[0] != '\0';
+        bool gridClickable = !state.showSegmentMenu && mousePoint.y < (screenHeight - CONTROL_PANEL_HEIGHT);
+        float groupY = padding + state.scrollY;
+
+        // Thumbnails are requested a row beyond the viewport, further in the
+        // direction of scrolling (content moves up as scrollY falls)
+        float gridBottom = screenHeight - CONTROL_PANEL_HEIGHT;
+        float lookahead = state.scrollVelocity*THUMBNAIL_LOOKAHEAD;
+        float prefetchTop = -(buttonHeight + padding) - fmaxf(lookahead, 0.0f);
+        float prefetchBottom = gridBottom + (buttonHeight + padding) + fmaxf(-lookahead, 0.0f);
+        int hoveredLevel = -1;
+        for (int g = 0; g < state.layerCount; g++) {
+            LayerGroup *group = &state.layers[g];
+            int shown = group->levelCount;
+            if (searching) {
+                shown = 0;
+                for (int k = 0; k < group->levelCount; k++) shown += (state.searchSegment[group->levels[k]] >= 0);
+            }
+            if (shown == 0) continue;
+            bool expanded = IsLayerExpanded(&state, g);
+
+            if (state.showLayerHeaders) {
+                Rectangle header = { state.startX, groupY, screenWidth - 2*state.startX, LAYER_HEADER_HEIGHT };
+                bool hovered = CheckCollisionPointRec(mousePoint, header);
+                if (hovered && gridClickable && !searching && IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
+                    SetLayerCollapsed(&state, g, !group->collapsed);
                 }
+                char headerText[160];
+                snprintf(headerText, sizeof(headerText), "%s %s (%d)", expanded ? "-" : "+", group->name, shown);
+                DrawRectangleRec(header, hovered ? MIDRED : DARKRED);
+                DrawText(headerText, header.x + 10, header.y + (LAYER_HEADER_HEIGHT - FONT_SIZE_XLARGE)/2, FONT_SIZE_XLARGE, RAYWHITE);
+                groupY += LAYER_HEADER_HEIGHT + padding/2;
+            }
+            if (!expanded) continue;
+
+            int slot = 0;
+            for (int k = 0; k < group->levelCount; k++) {
+                int i = group->levels[k];
+                if (state.searchSegment[i] < 0) continue;
+                int row = slot / state.buttonsPerRow;
+                int col = slot % state.buttonsPerRow;
+                slot++;
+                float x = state.startX + col * (buttonWidth + padding);
+                float y = groupY + row * (buttonHeight + padding);
 
-                state.currentPlaying = i;
-                state.levels[i].currentSegment = 0;
-                Segment *newSeg = &state.levels[i].segments[0];
-                PlayMusicStream(newSeg->free);
-                if (newSeg->hasCombat) {
-                    PlayMusicStream(newSeg->combat);
-                    SetMusicVolume(newSeg->free, state.persistentCombat ? 0.0f : 1.0f);
-                    SetMusicVolume(newSeg->combat, state.persistentCombat ? 1.0f : 0.0f);
+                bool visible = y + buttonHeight > 0 && y < gridBottom;
+                if (y + buttonHeight > prefetchTop && y < prefetchBottom) RequestThumbnail(&state.levels[i], visible);
+                if (!visible) continue;
+                bool thumbnailReady = UseThumbnail(&state.levels[i]);
+
+                // Create image button
+                Button levelBtn = CreateImageButton(
+                    (Rectangle){x, y, buttonWidth, buttonHeight},
+                    state.levels[i].thumbnail,
+                    fminf((buttonWidth - 20) / (float)state.levels[i].thumbnail.width, 
+                         (buttonHeight - 40) / (float)state.levels[i].thumbnail.height),
+                    state.levels[i].name,
+                    (i == state.currentPlaying) ? RED : DARKRED,
+                    MIDRED, LIGHTGRAY,
+                    GetFontDefault(),
+                    10, 1.0f, true,
+                    (Rectangle){x + padding/2, y + buttonHeight - 30, buttonWidth - padding, 30}
+                );
+
+                levelBtn.isHovered = IsButtonHovered(levelBtn, mousePoint);
+                if (levelBtn.isHovered && gridClickable) hoveredLevel = i;
+                if (IsButtonClicked(levelBtn, mousePoint) && gridClickable) {
+                    PushPlaybackCommand(&state, PLAYBACK_PLAY_LEVEL, i, state.searchSegment[i]);
+                }
+                DrawButton(&levelBtn);
+                if (!thumbnailReady) {
+                    DrawRectangle(x + 20, y + 10, buttonWidth - 40, buttonHeight - 50, Fade(LIGHTGRAY, 0.15f));
                 }
-                state.isPaused = false;
-                state.showSegmentMenu = false;
             }
-            DrawButton(&levelBtn);
+            groupY += ((slot + state.buttonsPerRow - 1) / state.buttonsPerRow) * (buttonHeight + padding);
+        }
+        state.contentHeight = groupY - state.scrollY;
+
+        // Resting on a tile opens and decodes what a click on it would play
+        UpdateHoverPrefetch(&state, hoveredLevel, hoveredLevel != -1 ? state.searchSegment[hoveredLevel] : 0);
+        DrawSearchBar(&state, screenWidth);
+
+        // Draw spectrum panel over the bottom of the grid
+        if (IsSpectrumEnabled()) {
+            DrawSpectrum((Rectangle){ 0, screenHeight - CONTROL_PANEL_HEIGHT - VISUALIZER_HEIGHT, screenWidth, VISUALIZER_HEIGHT },
+                         Fade(RAYWHITE, 0.35f));
         }
 
         // Draw control panel
@@ -234,16 +309,23 @@ int main(void) {
         // Draw progress bar
         if (state.currentPlaying != -1) {
             Segment *currentSeg = &state.levels[state.currentPlaying].segments[state.levels[state.currentPlaying].currentSegment];
-            float musicTime = GetMusicTimePlayed(currentSeg->free);
-            float musicLength = GetMusicTimeLength(currentSeg->free);
+            float musicTime = GetMusicTimePlayed(currentSeg->stems[0].music);
+            float musicLength = GetMusicTimeLength(currentSeg->stems[0].music);
+            if (state.draggingProgress) musicTime = state.dragProgress*musicLength;
 
             // Draw outline
             DrawRectangleRec(state.progressBar, DARKERRED);
             
-            // Draw progress fill
-            Rectangle progressFill = state.progressBar;
-            progressFill.width = state.progressBar.width * (musicLength > 0 ? musicTime/musicLength : 0);
-            DrawRectangleRec(progressFill, RAYWHITE);
+            // Draw waveform overview, or a plain fill until it is ready
+            float progress = musicLength > 0 ? musicTime/musicLength : 0;
+            const Waveform *waveform = GetWaveform(currentSeg->stems[0].path);
+            if (waveform != NULL) {
+                DrawWaveform(waveform, state.progressBar, progress, RAYWHITE, MIDRED);
+            } else {
+                Rectangle progressFill = state.progressBar;
+                progressFill.width = state.progressBar.width * progress;
+                DrawRectangleRec(progressFill, RAYWHITE);
+            }
 
             // Format time text
             char timeText[32];
@@ -267,9 +349,43 @@ int main(void) {
             HandleSegmentMenu(&state);
         }
 
+        // Apply everything queued this frame
+        ProcessPlaybackCommands(&state);
+        PublishControlStatus(&state);
+
+        // Escape leaves the search bar instead of closing the window
+        SetExitKey(state.searchFocused ? KEY_NULL : KEY_ESCAPE);
         EndDrawing();
+
+        // Remaining streams and thumbnail uploads, after this frame is on screen
+        UpdateThumbnails(&state);
+        // The warm streams wait for the preload, or they would open from disk
+        if (IsPreloadFinished()) UpdateAssetLoading(&state, ASSET_LOAD_BUDGET);
+        UpdateDecoderCache(&state);
+        UpdatePreload(&state);
+        UpdateResampling(&state);
+        UpdateReadAhead(&state);
     }
 
+    SaveSession(&state);
+    PrintEngineStats();
+    CloseControlSocket();
+    CloseSharedIntensity();
+    CloseJobSystem();
+    CloseLoudnessAnalysis();
+    CloseWaveforms();
+    CloseThumbnails(&state);
+    CloseSpectrum();
+    FreeSearchIndex();
+
+    for (int i = 0; i < state.levelCount; i++) {
+        for (int j = 0; j < state.levels[i].segmentCount; j++) UnloadSegmentStreams(&state.levels[i].segments[j]);
+    }
+    FreeLevels(&state);
+    ClosePreload();
+    CloseResampling();
+    CloseAssetPack();
+    CloseAudioClock();
     CloseAudioDevice();
     CloseWindow();
     return 0;
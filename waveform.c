@@ -0,0 +1,214 @@
+#include "waveform.h"
+#include "jobs.h"
+#include "pack.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Samples converted per pass while computing an overview
+#define WAVEFORM_CHUNK 4096
+
+typedef enum {
+    WAVEFORM_QUEUED,
+    WAVEFORM_READY,
+    WAVEFORM_FAILED
+} WaveformStatus;
+
+typedef struct WaveformEntry {
+    char path[512];
+    long modTime;
+    bool waiting;               // did not fit the job queue, GetWaveform retries
+    _Atomic int status;         // written by the worker, read by the main loop
+    Waveform waveform;
+} WaveformEntry;
+
+static WaveformEntry **waveforms = NULL;
+static int waveformCount = 0;
+static int waveformCapacity = 0;
+static WaveformEntry *lastWaveform = NULL;
+
+static void GetWaveformCachePath(const char *path, char *cachePath, int size) {
+    // FNV-1a
+    uint64_t hash = 1469598103934665603ULL;
+    for (const unsigned char *c = (const unsigned char *)path; *c; c++) {
+        hash ^= *c;
+        hash *= 1099511628211ULL;
+    }
+    snprintf(cachePath, size, "%s/%016llx.wave", CACHE_FOLDER, (unsigned long long)hash);
+}
+
+// Header: magic, version, mtime, bucket count, path length, path; then min and max
+static bool LoadWaveformCache(WaveformEntry *entry) {
+    char cachePath[512];
+    GetWaveformCachePath(entry->path, cachePath, sizeof(cachePath));
+    FILE *file = fopen(cachePath, "rb");
+    if (file == NULL) return false;
+
+    uint32_t header[3];
+    int64_t modTime;
+    uint32_t pathLength;
+    char path[512];
+    bool valid = fread(header, sizeof(header), 1, file) == 1 &&
+                 fread(&modTime, sizeof(modTime), 1, file) == 1 &&
+                 fread(&pathLength, sizeof(pathLength), 1, file) == 1 &&
+                 header[0] == WAVEFORM_CACHE_MAGIC && header[1] == WAVEFORM_CACHE_VERSION &&
+                 header[2] == WAVEFORM_BUCKETS && modTime == entry->modTime &&
+                 pathLength < sizeof(path) && fread(path, 1, pathLength, file) == pathLength;
+    if (valid) {
+        path[pathLength] = '\0';
+        valid = strcmp(path, entry->path) == 0 &&
+                fread(entry->waveform.min, sizeof(entry->waveform.min), 1, file) == 1 &&
+                fread(entry->waveform.max, sizeof(entry->waveform.max), 1, file) == 1;
+    }
+    fclose(file);
+    return valid;
+}
+
+static void SaveWaveformCache(const WaveformEntry *entry) {
+    char cachePath[512];
+    GetWaveformCachePath(entry->path, cachePath, sizeof(cachePath));
+    FILE *file = fopen(cachePath, "wb");
+    if (file == NULL) return;
+
+    uint32_t header[3] = { WAVEFORM_CACHE_MAGIC, WAVEFORM_CACHE_VERSION, WAVEFORM_BUCKETS };
+    int64_t modTime = entry->modTime;
+    uint32_t pathLength = (uint32_t)strlen(entry->path);
+    fwrite(header, sizeof(header), 1, file);
+    fwrite(&modTime, sizeof(modTime), 1, file);
+    fwrite(&pathLength, sizeof(pathLength), 1, file);
+    fwrite(entry->path, 1, pathLength, file);
+    fwrite(entry->waveform.min, sizeof(entry->waveform.min), 1, file);
+    fwrite(entry->waveform.max, sizeof(entry->waveform.max), 1, file);
+    fclose(file);
+}
+
+static bool ComputeWaveform(WaveformEntry *entry) {
+    Wave wave = LoadAssetWave(entry->path);
+    if (wave.data == NULL || wave.frameCount == 0) {
+        UnloadWave(wave);
+        return false;
+    }
+
+    // Peaks over every channel, so a hard-panned part still shows. Float files can
+    // go past full scale, which the bar has no room for
+    Waveform *waveform = &entry->waveform;
+    float chunk[WAVEFORM_CHUNK];
+    for (int b = 0; b < WAVEFORM_BUCKETS; b++) {
+        size_t first = (size_t)wave.frameCount*b/WAVEFORM_BUCKETS*wave.channels;
+        size_t last = (size_t)wave.frameCount*(b + 1)/WAVEFORM_BUCKETS*wave.channels;
+        float low = 0.0f, high = 0.0f;
+        for (size_t i = first; i < last; i += WAVEFORM_CHUNK) {
+            int count = (last - i < WAVEFORM_CHUNK) ? (int)(last - i) : WAVEFORM_CHUNK;
+            ReadWaveSamples(&wave, i, chunk, count);
+            dsp.ClampSamples(chunk, count, 1.0f);
+            for (int j = 0; j < count; j++) {
+                if (chunk[j] < low) low = chunk[j];
+                if (chunk[j] > high) high = chunk[j];
+            }
+        }
+        waveform->min[b] = low;
+        waveform->max[b] = high;
+    }
+    UnloadWave(wave);
+    return true;
+}
+
+static void WaveformJob(void *data) {
+    WaveformEntry *entry = (WaveformEntry *)data;
+    bool ready = LoadWaveformCache(entry);
+    if (!ready) {
+        ready = ComputeWaveform(entry);
+        if (ready) SaveWaveformCache(entry);
+    }
+    atomic_store_explicit(&entry->status, ready ? WAVEFORM_READY : WAVEFORM_FAILED, memory_order_release);
+}
+
+static WaveformEntry *FindWaveform(const char *path) {
+    if (lastWaveform != NULL && strcmp(lastWaveform->path, path) == 0) return lastWaveform;
+    for (int i = 0; i < waveformCount; i++) {
+        if (strcmp(waveforms[i]->path, path) == 0) return lastWaveform = waveforms[i];
+    }
+    return NULL;
+}
+
+// Asked for every frame the segment is on screen, so it goes in front of the
+// background analysis and a full queue is retried on the next frame
+const Waveform *GetWaveform(const char *path) {
+    WaveformEntry *entry = FindWaveform(path);
+    if (entry != NULL && entry->waiting) {
+        entry->waiting = !SubmitUrgentJob(WaveformJob, entry);
+        return NULL;
+    }
+    if (entry == NULL) {
+        if (waveformCount == waveformCapacity) {
+            int capacity = waveformCapacity ? waveformCapacity*2 : 32;
+            WaveformEntry **entries = (WaveformEntry **)realloc(waveforms, sizeof(WaveformEntry *)*capacity);
+            if (entries == NULL) return NULL;
+            waveforms = entries;
+            waveformCapacity = capacity;
+        }
+        entry = (WaveformEntry *)calloc(1, sizeof(WaveformEntry));
+        if (entry == NULL) return NULL;
+        snprintf(entry->path, sizeof(entry->path), "%s", path);
+        entry->modTime = GetAssetModTime(path);
+        waveforms[waveformCount++] = entry;
+        lastWaveform = entry;
+
+        if (!DirectoryExists(CACHE_FOLDER)) MakeDirectory(CACHE_FOLDER);
+        entry->waiting = !SubmitUrgentJob(WaveformJob, entry);
+        return NULL;
+    }
+    return (atomic_load_explicit(&entry->status, memory_order_acquire) == WAVEFORM_READY) ? &entry->waveform : NULL;
+}
+
+void DrawWaveform(const Waveform *waveform, Rectangle bounds, float progress, Color played, Color remaining) {
+    static Vector2 points[2*(WAVEFORM_MAX_COLUMNS + 1)];
+
+    int columns = (int)bounds.width;
+    if (columns > WAVEFORM_MAX_COLUMNS) columns = WAVEFORM_MAX_COLUMNS;
+    if (columns < 1) return;
+
+    // One column per pixel, each covering its share of the buckets
+    float middle = bounds.y + bounds.height/2.0f;
+    float scale = bounds.height/2.0f;
+    float columnWidth = bounds.width/columns;
+    for (int x = 0; x < columns; x++) {
+        int first = x*WAVEFORM_BUCKETS/columns;
+        int last = (x + 1)*WAVEFORM_BUCKETS/columns;
+        if (last <= first) last = first + 1;
+        float low = 0.0f, high = 0.0f;
+        for (int b = first; b < last; b++) {
+            if (waveform->min[b] < low) low = waveform->min[b];
+            if (waveform->max[b] > high) high = waveform->max[b];
+        }
+        // At least a pixel tall, so quiet passages still show
+        float top = middle - high*scale;
+        float bottom = middle - low*scale;
+        if (bottom - top < 1.0f) {
+            top = middle - 0.5f;
+            bottom = middle + 0.5f;
+        }
+        points[2*x] = (Vector2){ bounds.x + x*columnWidth, top };
+        points[2*x + 1] = (Vector2){ bounds.x + x*columnWidth, bottom };
+    }
+    // Close the last column at the right edge
+    points[2*columns] = (Vector2){ bounds.x + bounds.width, points[2*columns - 2].y };
+    points[2*columns + 1] = (Vector2){ bounds.x + bounds.width, points[2*columns - 1].y };
+
+    int split = (int)(progress*columns + 0.5f);
+    if (split < 0) split = 0;
+    if (split > columns) split = columns;
+    if (split > 0) DrawTriangleStrip(points, 2*(split + 1), played);
+    if (split < columns) DrawTriangleStrip(points + 2*split, 2*(columns - split + 1), remaining);
+}
+
+void CloseWaveforms(void) {
+    // Workers must be stopped first, they write into the entries
+    for (int i = 0; i < waveformCount; i++) free(waveforms[i]);
+    free(waveforms);
+    waveforms = NULL;
+    waveformCount = waveformCapacity = 0;
+    lastWaveform = NULL;
+}
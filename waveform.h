@@ -0,0 +1,27 @@
+#ifndef WAVEFORM_H
+#define WAVEFORM_H
+
+#include "functions.h"
+
+// Min/max overview of a file at a fixed resolution, computed on a job worker
+// and cached as CACHE_FOLDER/<path hash>.wave
+#define WAVEFORM_BUCKETS 512
+#define WAVEFORM_MAX_COLUMNS 2048
+#define WAVEFORM_CACHE_MAGIC 0x46575055     // "UPWF"
+#define WAVEFORM_CACHE_VERSION 1
+
+typedef struct Waveform {
+    float min[WAVEFORM_BUCKETS];
+    float max[WAVEFORM_BUCKETS];
+} Waveform;
+
+// NULL until the overview is ready; the first call for a path queues it
+const Waveform *GetWaveform(const char *path);
+
+// Played part in one color, the rest in another, one triangle strip each.
+// Cost depends on the bar width only
+void DrawWaveform(const Waveform *waveform, Rectangle bounds, float progress, Color played, Color remaining);
+
+void CloseWaveforms(void);
+
+#endif